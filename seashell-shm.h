@@ -0,0 +1,93 @@
+/*
+ * seashell-shm.h - the layout of the job table that Sea Shell publishes in shared memory for the monitoring tools (seashell-top)
+ *
+ * Every shell creates the POSIX shared memory object "/seashell-top-PID" (i.e. /dev/shm/seashell-top-PID) holding one
+ * seashellShmTable, and removes it when it exits. The shell is the only writer; any number of readers may map the object read-only.
+ *
+ * The table is protected with a sequence lock: the writer makes the sequence number odd, updates the table, and makes it even again.
+ * A reader copies the table and accepts the copy only if the sequence number was the same even number before and after the copy;
+ * otherwise, it simply tries again. So the readers never block the shell, and they need no system calls to take a snapshot.
+ */
+
+#ifndef SEASHELL_SHM_H
+#define SEASHELL_SHM_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define SEASHELL_SHM_PREFIX "/seashell-top-"   // followed by the PID of the shell
+#define SEASHELL_SHM_MAGIC 0x4a535353  // "SSSJ"
+#define SEASHELL_SHM_VERSION 1
+#define SEASHELL_SHM_JOBS 256   // Only this many first jobs of the job table are published
+#define SEASHELL_SHM_COMMAND 128    // Published length of the path to the executable (including the '\0'; longer paths are truncated)
+
+// Execution status of a published job
+#define SEASHELL_SHM_RUNNING 0
+#define SEASHELL_SHM_STOPPED 1
+#define SEASHELL_SHM_DONE 2
+#define SEASHELL_SHM_TERMINATED 3
+#define SEASHELL_SHM_TIMEDOUT 4
+
+// seashellShmJob - a published job
+typedef struct seashellShmJob {
+    uint32_t jobId; // stable job ID: unlike the job number, it doesn't change when other jobs leave the job table
+    int32_t pid;
+    int32_t status; // one of the SEASHELL_SHM_... values
+    int32_t exitCode;   // the wait status of a job which is not running (see wait4())
+    int32_t background; // non-zero if the job is in the background
+    uint32_t reserved;
+    uint64_t startTime; // when the job was launched (CLOCK_REALTIME, in nanoseconds)
+    uint64_t cpuTime;   // CPU time used by the job (user + system, in nanoseconds) at the moment of the last update
+    char command[SEASHELL_SHM_COMMAND]; // path to the executable
+} seashellShmJob;
+
+// seashellShmTable - the whole shared memory object
+typedef struct seashellShmTable {
+    uint32_t magic; // SEASHELL_SHM_MAGIC
+    uint32_t version;   // SEASHELL_SHM_VERSION
+    int32_t shellPid;
+    uint32_t closed;    // set when the shell exits: the table will not be updated anymore
+    uint32_t sequence;  // the sequence lock: odd while the table is being updated
+    uint32_t count; // number of the published jobs
+    uint32_t total; // number of the jobs in the job table (more than 'count' if not all of them fit)
+    uint32_t reserved;
+    uint64_t updated;   // when the table was updated the last time (CLOCK_REALTIME, in nanoseconds)
+    seashellShmJob jobs[SEASHELL_SHM_JOBS];
+} seashellShmTable;
+
+// seashellShmBeginWrite() - starts an update of the table (the writer's side of the sequence lock)
+static inline void seashellShmBeginWrite(seashellShmTable* t) {
+    __atomic_store_n(&t->sequence, t->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);    // The odd sequence number is visible before any change of the table
+}
+
+// seashellShmEndWrite() - finishes an update of the table
+static inline void seashellShmEndWrite(seashellShmTable* t) {
+    __atomic_store_n(&t->sequence, t->sequence + 1, __ATOMIC_RELEASE);  // All the changes are visible before the even sequence number
+}
+
+/*
+ * seashellShmRead() - takes a consistent snapshot of the table (the reader's side of the sequence lock)
+ * Only the header and the published jobs are copied. Returns 0 on success, and -1 if the writer kept changing the table
+ * during all the attempts (the caller may simply try again later).
+ */
+static inline int seashellShmRead(const seashellShmTable* t, seashellShmTable* copy) {
+    uint32_t before, count;
+    int attempt;
+
+    for (attempt = 0; attempt < 1000; attempt++) {
+        before = __atomic_load_n(&t->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1) continue;   // An update is in progress
+        memcpy(copy, t, sizeof(seashellShmTable) - sizeof(t->jobs));
+        count = copy->count <= SEASHELL_SHM_JOBS ? copy->count : SEASHELL_SHM_JOBS;
+        memcpy(copy->jobs, t->jobs, count * sizeof(seashellShmJob));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);    // The copy is complete before the sequence number is checked again
+        if (__atomic_load_n(&t->sequence, __ATOMIC_RELAXED) == before) {
+            copy->count = count;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+#endif
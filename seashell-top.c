@@ -0,0 +1,296 @@
+/*
+ * seashell-top - shows the job tables of the running Sea Shell instances
+ *
+ * Every shell publishes its job table in the shared memory object /dev/shm/seashell-top-PID (see seashell-shm.h). seashell-top maps
+ * the tables once, and then every refresh is just a consistent copy of each table (a sequence lock), with no system calls per shell,
+ * so hundreds of shells can be watched cheaply. Without arguments, all the shells of the user are shown (the new ones are picked up
+ * every RESCAN_REFRESHES refreshes); otherwise, only the shells with the given PIDs. A shell killed with SIGKILL cannot mark its
+ * table as closed, so at the same interval the watched shells are also checked to be alive.
+ *
+ * Build: gcc -Wall -O2 -o seashell-top seashell-top.c
+ * Usage: seashell-top [-d seconds] [-n refreshes] [shell_PID]...
+ */
+
+#define _GNU_SOURCE
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>  // shm_open() flags
+#include <sys/mman.h>   // shm_open(), mmap()
+#include <sys/stat.h>
+#include <dirent.h> // Scanning /dev/shm for the shells
+#include <time.h>   // clock_gettime(), nanosleep()
+#include <signal.h> // kill() - checking whether a shell is still alive
+
+#include "seashell-shm.h"
+
+#define RESCAN_REFRESHES 10 // Without PIDs given, /dev/shm is scanned for new shells every this many refreshes
+
+// watchedShell - a struct type for a shell being watched
+typedef struct watchedShell {
+    int pid;
+    const seashellShmTable* table;  // the table of the shell, mapped read-only
+    seashellShmTable* now;  // the latest snapshot of the table
+    seashellShmTable* before;   // the previous snapshot (for the CPU usage)
+    int seen;   // non-zero if the object was found by the latest scan of /dev/shm
+} watchedShell;
+
+watchedShell* shells = NULL;
+unsigned int shellCount = 0, shellCap = 0;
+
+// nowNs() - returns the current time (CLOCK_REALTIME) in nanoseconds; clock_gettime() is served by the vDSO, without a system call
+uint64_t nowNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// findShell() - returns the index of the watched shell with the given PID, or -1
+int findShell(int pid) {
+    unsigned int i;
+
+    for (i = 0; i < shellCount; i++) if (shells[i].pid == pid) return i;
+    return -1;
+}
+
+/*
+ * _isAlive() - returns non-zero if the process exists (it may belong to another user) and is not a zombie
+ * A killed shell stays a zombie until its parent waits for it, but its table will never be updated again.
+ */
+int _isAlive(int pid) {
+    char path[64], stat[512];
+    char* state;
+    FILE* f;
+    size_t len;
+
+    if (kill(pid, 0) != 0 && errno == ESRCH) return 0;
+    sprintf(path, "/proc/%d/stat", pid);
+    if ((f = fopen(path, "r")) == NULL) return 1;   // (no /proc: trust kill())
+    len = fread(stat, 1, sizeof(stat) - 1, f);
+    fclose(f);
+    stat[len] = '\0';
+    state = strrchr(stat, ')');    // "pid (command) state ..."; the command may contain ')'
+    return state == NULL || (state[1] != ' ' || (state[2] != 'Z' && state[2] != 'X'));
+}
+
+/*
+ * watchShell() - maps the table of the shell with the given PID and adds the shell to the watched ones
+ * Returns 0 on success, and -1 if the shell doesn't publish a (compatible) table or is not alive (a stale object of a shell killed
+ * with SIGKILL); with 'verbose', the reason is printed.
+ */
+int watchShell(int pid, int verbose) {
+    char name[64];
+    int fd;
+    struct stat st;
+    const seashellShmTable* t;
+    watchedShell* w;
+
+    if (!_isAlive(pid)) {
+        if (verbose) fprintf(stderr, "seashell-top: shell %d: not running.\n", pid);
+        return -1;
+    }
+    sprintf(name, SEASHELL_SHM_PREFIX "%d", pid);
+    if ((fd = shm_open(name, O_RDONLY, 0)) < 0) {
+        if (verbose) fprintf(stderr, "seashell-top: shell %d: %s.\n", pid, strerror(errno));
+        return -1;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(seashellShmTable)) {
+        if (verbose) fprintf(stderr, "seashell-top: shell %d: the table is not ready.\n", pid);
+        close(fd);
+        return -1;
+    }
+    t = (const seashellShmTable*) mmap(NULL, sizeof(seashellShmTable), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);  // The mapping stays
+    if (t == MAP_FAILED) {
+        if (verbose) fprintf(stderr, "seashell-top: shell %d: %s.\n", pid, strerror(errno));
+        return -1;
+    }
+    if (t->magic != SEASHELL_SHM_MAGIC || t->version != SEASHELL_SHM_VERSION) {
+        if (verbose) fprintf(stderr, "seashell-top: shell %d: unknown table format.\n", pid);
+        munmap((void*) t, sizeof(seashellShmTable));
+        return -1;
+    }
+
+    if (shellCount == shellCap) {
+        shellCap = shellCap ? shellCap * 2 : 16;
+        shells = (watchedShell*) realloc(shells, shellCap * sizeof(watchedShell));
+        if (!shells) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+    }
+    w = &shells[shellCount++];
+    w->pid = pid;
+    w->table = t;
+    w->now = (seashellShmTable*) calloc(1, sizeof(seashellShmTable));
+    w->before = (seashellShmTable*) calloc(1, sizeof(seashellShmTable));
+    if (!w->now || !w->before) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+    w->seen = 1;
+    return 0;
+}
+
+// dropShell() - stops watching the shell (it has exited)
+void dropShell(unsigned int i) {
+    munmap((void*) shells[i].table, sizeof(seashellShmTable));
+    free(shells[i].now);
+    free(shells[i].before);
+    shells[i] = shells[--shellCount];
+}
+
+// pruneShells() - stops watching the shells which are gone without closing their tables (e.g. killed with SIGKILL)
+void pruneShells() {
+    unsigned int i;
+
+    for (i = 0; i < shellCount; ) {
+        if (!_isAlive(shells[i].pid)) dropShell(i);
+        else i++;
+    }
+}
+
+/*
+ * scanShells() - watches all the live shells found in /dev/shm which are not watched yet, and stops watching the ones
+ * whose objects have been removed
+ */
+void scanShells() {
+    DIR* dir = opendir("/dev/shm");
+    struct dirent* e;
+    const char* prefix = SEASHELL_SHM_PREFIX + 1;   // (without the '/')
+    char* end;
+    long pid;
+    int i;
+
+    if (dir == NULL) return;
+    for (i = 0; i < (int) shellCount; i++) shells[i].seen = 0;
+    while ((e = readdir(dir)) != NULL) {
+        if (strncmp(e->d_name, prefix, strlen(prefix)) != 0) continue;
+        pid = strtol(e->d_name + strlen(prefix), &end, 10);
+        if (*end != '\0' || pid <= 0) continue;
+        if ((i = findShell((int) pid)) >= 0) shells[i].seen = 1;
+        else watchShell((int) pid, 0);
+    }
+    closedir(dir);
+
+    for (i = 0; i < (int) shellCount; ) {
+        if (!shells[i].seen) dropShell(i);
+        else i++;
+    }
+}
+
+// _formatDuration() - formats a duration in nanoseconds as "h:mm:ss" or "m:ss.cc"
+void _formatDuration(char* buf, uint64_t ns) {
+    uint64_t cs = ns / 10000000ull;
+
+    if (cs >= 360000) sprintf(buf, "%llu:%02llu:%02llu", (unsigned long long) (cs / 360000), (unsigned long long) (cs / 6000 % 60),
+        (unsigned long long) (cs / 100 % 60));
+    else sprintf(buf, "%llu:%02llu.%02llu", (unsigned long long) (cs / 6000), (unsigned long long) (cs / 100 % 60),
+        (unsigned long long) (cs % 100));
+}
+
+// _cpuBefore() - returns the CPU time of the job in the previous snapshot of the table, or -1 if the job wasn't there
+int64_t _cpuBefore(const seashellShmTable* before, uint32_t jobId) {
+    uint32_t i;
+
+    for (i = 0; i < before->count; i++) if (before->jobs[i].jobId == jobId) return (int64_t) before->jobs[i].cpuTime;
+    return -1;
+}
+
+/*
+ * refresh() - takes a snapshot of every watched table and prints all the jobs
+ * The CPU usage is the CPU time used since the previous snapshot, relative to the wall clock time between the snapshots.
+ */
+void refresh(int clear) {
+    const char* statuses[] = { "Running", "Stopped", "Done", "Terminated", "Timed out" };
+    seashellShmTable* swap;
+    const seashellShmJob* j;
+    unsigned int i, jobs = 0;
+    uint32_t k;
+    uint64_t now = nowNs();
+    int64_t cpu;
+    double usage;
+    char elapsed[32], cpuTime[32], status[16];
+
+    for (i = 0; i < shellCount; ) {
+        swap = shells[i].before;    // The latest snapshot becomes the previous one
+        shells[i].before = shells[i].now;
+        shells[i].now = swap;
+        if (seashellShmRead(shells[i].table, shells[i].now) != 0) *shells[i].now = *shells[i].before; // Busy: show the previous one
+        if (shells[i].now->closed) dropShell(i);    // The shell has exited
+        else jobs += shells[i++].now->total;
+    }
+
+    if (clear) printf("\033[H\033[2J");
+    printf("seashell-top: %u shells, %u jobs\n\n", shellCount, jobs);
+    printf("%-8s %5s %8s  %-12s %6s %10s %10s  %s\n", "SHELL", "JOB", "PID", "STATUS", "CPU%", "CPU TIME", "ELAPSED", "COMMAND");
+
+    for (i = 0; i < shellCount; i++) {
+        for (k = 0; k < shells[i].now->count; k++) {
+            j = &shells[i].now->jobs[k];
+            cpu = _cpuBefore(shells[i].before, j->jobId);
+            usage = 0;
+            if (cpu >= 0 && shells[i].now->updated > shells[i].before->updated && j->cpuTime >= (uint64_t) cpu) {
+                usage = 100.0 * (j->cpuTime - cpu) / (shells[i].now->updated - shells[i].before->updated);
+            }
+            _formatDuration(cpuTime, j->cpuTime);
+            _formatDuration(elapsed, now > j->startTime ? now - j->startTime : 0);
+            snprintf(status, sizeof(status), "%s%s", statuses[j->status >= 0 && j->status <= SEASHELL_SHM_TIMEDOUT ? j->status : 0],
+                j->background ? " &" : "");
+            printf("%-8d %5u %8d  %-12s %6.1f %10s %10s  %s\n", shells[i].pid, j->jobId, j->pid, status, usage, cpuTime, elapsed, j->command);
+        }
+        if (shells[i].now->total > shells[i].now->count) {
+            printf("%-8d (%u more jobs are not published)\n", shells[i].pid, shells[i].now->total - shells[i].now->count);
+        }
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char** argv) {
+    double delay = 2;   // seconds between the refreshes
+    long refreshes = -1;    // number of the refreshes; -1 means forever
+    int scan = 1;   // non-zero if the shells are to be found in /dev/shm
+    int clear = isatty(STDOUT_FILENO);
+    struct timespec ts;
+    char* end;
+    long n;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            delay = strtod(argv[++i], &end);
+            if (*argv[i] == '\0' || *end != '\0' || delay <= 0) break;
+        }
+        else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            refreshes = strtol(argv[++i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || refreshes < 1) break;
+        }
+        else {
+            n = strtol(argv[i], &end, 10);
+            if (*argv[i] == '\0' || *end != '\0' || n <= 0) break;
+            scan = 0;
+            if (findShell((int) n) < 0 && watchShell((int) n, 1) != 0) return 1;
+        }
+    }
+    if (i < argc) {
+        fprintf(stderr, "Usage: seashell-top [-d seconds] [-n refreshes] [shell_PID]...\n");
+        return 2;
+    }
+
+    ts.tv_sec = (time_t) delay;
+    ts.tv_nsec = (long) ((delay - ts.tv_sec) * 1e9);
+
+    for (n = 0; refreshes < 0 || n < refreshes; n++) {
+        if (n % RESCAN_REFRESHES == 0) {
+            pruneShells();
+            if (scan) scanShells();
+        }
+        refresh(clear);
+        if (!scan && shellCount == 0) break;    // All the given shells have exited
+        if (refreshes < 0 || n + 1 < refreshes) nanosleep(&ts, NULL);
+    }
+    return 0;
+}
@@ -11,6 +11,8 @@
  * please contact me at VNL170@aubg.edu
  */
 
+#define _GNU_SOURCE // Needed for the CPU affinity functions and types (cpu_set_t, sched_setaffinity() etc.)
+
 #include <unistd.h> // All the system calls
 #include <stdlib.h> // Useful functions like exit() etc.
 #include <stdio.h>  // All the I/O
@@ -19,25 +21,166 @@
 #include <fcntl.h>  // Needed for named semaphores
 #include <sys/stat.h>   // Needed for named semaphores
 #include <sys/types.h>  // Types like pid_t, size_t, sem_t etc.
-#include <sys/wait.h>   // waitpid() function
+#include <sys/wait.h>   // waitpid() and wait4() functions
 #include <signal.h> // Functions for manipulating signals
 #include <semaphore.h>  // Functions for manipulating semaphores
+#include <sched.h>  // CPU affinity: sched_setaffinity() and cpu_set_t
+#include <sys/resource.h>   // setpriority() - the nice value of a process/process group
+#include <sys/syscall.h>    // syscall() - needed for ioprio_set(), pidfd_open() and pidfd_send_signal(), which have no wrappers in older glibc versions
+#include <poll.h>   // poll() - used by the 'wait' built-in command to wait for several pidfds at once
+#include <stdint.h> // Fixed-size integer types for the script cache file format
+#include <stdatomic.h>  // atomic_signal_fence() - the ordering of the status updates ring
+#include <sys/mman.h>   // mmap() - the script cache files are mapped into memory
+#include <time.h>   // clock_gettime() - the 'time' built-in command
+#include <linux/perf_event.h>   // Software performance counters for the 'time' built-in command
+#include <stdarg.h> // Variable argument lists (servePrintf())
+#include <sys/socket.h> // Unix domain sockets for the server mode
+#include <sys/un.h> // struct sockaddr_un
+#include <sys/epoll.h>  // The event loop of the server mode
+#include <sys/signalfd.h>   // SIGCHLD as a file descriptor in the server mode
+#include <sys/timerfd.h>    // The timer for the deadlines of the jobs (run --timeout)
+
+#include "seashell-shm.h"   // The layout of the job table published in shared memory for seashell-top
+
+// ioprio_set() constants (see linux/ioprio.h); glibc doesn't provide them
+#ifndef IOPRIO_CLASS_SHIFT
+#define IOPRIO_CLASS_SHIFT 13
+#endif
+#define IOPRIO_PRIO_VALUE(cls, data) (((cls) << IOPRIO_CLASS_SHIFT) | (data))
+#define IOPRIO_PRIO_CLASS(v) ((v) >> IOPRIO_CLASS_SHIFT)
+#define IOPRIO_PRIO_DATA(v) ((v) & ((1 << IOPRIO_CLASS_SHIFT) - 1))
+#define IOPRIO_CLASS_NONE 0
+#define IOPRIO_CLASS_RT 1
+#define IOPRIO_CLASS_BE 2
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_WHO_PGRP 2
+
+int interactive = 0; // non-zero if the standard input is a terminal, i.e. the shell controls the terminal and does job control
+int oneShot = 0;    // non-zero in the one-shot mode (-c): foreground commands are run without making jobs of them (see runQuietly())
+
+#define VAR_BUCKETS 64  // Size of the shell variables hash table
+
+// shellContext - a struct type for the state of the command language: the shell variables and $? (each server session has its own)
+typedef struct shellContext {
+    struct shellVar* vars[VAR_BUCKETS]; // the shell variables (a hash table with chaining, see getVariable())
+    int lastStatus; // exit status of the last command ($?): the exit code of a foreground job, 128+N if it was killed/stopped by the signal N
+} shellContext;
+
+shellContext mainContext;   // the context of the shell itself
+shellContext* context = &mainContext;   // the context in which the commands are executed now
 
 sem_t* mainBusy;    // We will use this semaphore in order to postpone the execution of the execv() call by the child process
                     // until the parent does all the preliminary tasks, like updating process' PID in the job table and outputting a diagnostic message
 
+// schedOptions - a struct type for the scheduling settings of a job (CPU affinity, nice value, I/O priority),
+// as requested with the 'run', 'renice' and 'bgpolicy' built-in commands
+typedef struct schedOptions {
+    char* cpuList;  // the CPU list as it was typed by the user (e.g. "0-3,6"); NULL if the affinity is not to be changed
+    cpu_set_t cpus; // the same CPU list converted into a CPU set
+    int setNice;    // non-zero if the nice value is to be changed
+    int nice;   // the nice value (-20..19)
+    int ioprio; // the I/O priority in the format expected by ioprio_set(); -1 if it is not to be changed
+} schedOptions;
+
+// Resource limits of a job (indices in limitOptions and limitNames[]), as requested with the 'run' and 'ulimit' built-in commands
+#define LIMIT_MEM 0 // address space (RLIMIT_AS), in bytes: --mem
+#define LIMIT_NOFILE 1  // open files (RLIMIT_NOFILE): --nofile
+#define LIMIT_CPU 2 // CPU time (RLIMIT_CPU), in seconds: --cpu
+#define LIMIT_FSIZE 3   // size of the written files (RLIMIT_FSIZE), in bytes: --fsize
+#define LIMITS 4
+#define LIMIT_NONE (-1) // processRecord.limitHit: no limit was hit
+
+// limitOptions - a struct type for the resource limits of a job
+typedef struct limitOptions {
+    int set[LIMITS];    // non-zero if the respective limit is to be set
+    rlim_t value[LIMITS];   // the limit; RLIM_INFINITY for "unlimited"
+} limitOptions;
+
+const char* limitNames[LIMITS] = { "mem", "nofile", "cpu", "fsize" };   // the options are "--" followed by the name
+const int limitResources[LIMITS] = { RLIMIT_AS, RLIMIT_NOFILE, RLIMIT_CPU, RLIMIT_FSIZE };
+
+// Report formats of the 'time' built-in command
+#define TIME_NONE 0 // not timed
+#define TIME_DEFAULT 1  // the default human-readable format, or the one given by the TIMEFORMAT environment variable
+#define TIME_POSIX 2    // time -p
+
+// Software performance counters of a timed job (indices in processRecord.perfFds)
+#define PERF_TASK_CLOCK 0
+#define PERF_CONTEXT_SWITCHES 1
+#define PERF_PAGE_FAULTS 2
+#define PERF_COUNTERS 3
+
+// timeoutOptions - a struct type for the deadline of a job, as requested with the 'run', 'fg' and 'bg' built-in commands
+typedef struct timeoutOptions {
+    int set;    // non-zero if --timeout was given
+    double timeout; // seconds until SIGTERM is sent to the job; 0 means no deadline (removes the deadline of the job in 'fg'/'bg')
+    double killAfter;   // seconds from SIGTERM to SIGKILL; 0 means that SIGKILL is not sent
+} timeoutOptions;
+
+// launchOptions - a struct type for everything that newProcess() sets up for the child, besides the command itself
+typedef struct launchOptions {
+    schedOptions sched; // scheduling settings (see the 'run' built-in command)
+    timeoutOptions timeout; // the deadline of the job (see the 'run' built-in command)
+    limitOptions limits;    // resource limits (see the 'run' built-in command)
+    int stdinFd;    // file descriptor to become the standard input of the child (here-documents and here-strings); -1 to keep the shell's one
+    int timed;  // if not TIME_NONE, the job is timed (see the 'time' built-in command); newProcess() resets it once the job takes over the timing
+} launchOptions;
+
+schedOptions bgPolicy;  // The settings applied automatically to every job started with '&' (see the 'bgpolicy' built-in command)
+int bgPolicyOn = 0; // non-zero if bgPolicy is to be applied
+limitOptions jobLimits; // The resource limits applied to every job, unless it sets its own (see the 'ulimit' built-in command)
+
 typedef enum processStatus {    // Enum type for a process' execution status
-    running, stopped, done, terminated
+    running, stopped, done, terminated, timedout    // timedout: the job finished after its deadline had expired (see 'run --timeout')
 } processStatus;
 
+// Stages of the deadline of a job (processRecord.timeoutStage)
+#define TIMEOUT_NONE 0  // the job has no deadline
+#define TIMEOUT_ARMED 1 // SIGTERM will be sent when the deadline expires
+#define TIMEOUT_TERM 2  // SIGTERM was sent; SIGKILL will be sent when the deadline expires (if there is one)
+#define TIMEOUT_KILL 3  // SIGKILL was sent
+
+// Output capture (see the 'capture' built-in command)
+#define CAPTURE_RING_SIZE (64 * 1024)   // Every captured job keeps this many last bytes of its output in memory
+#define CAPTURE_LOG_STEP (1024 * 1024)  // The log files grow (and are mapped into memory) in steps of this size
+
+// outputRing - a struct type for the captured output of a job
+typedef struct outputRing {
+    char data[CAPTURE_RING_SIZE];   // the ring buffer: the byte at the position 'pos' of the output is kept in data[pos % CAPTURE_RING_SIZE]
+    size_t total;   // number of bytes captured so far
+    size_t shown;   // number of bytes shown so far (by 'output' or 'fg')
+    int logFd;  // the log file with the whole output; -1 if there's none
+    char* logPath;  // path to the log file
+    char* log;  // the log file mapped into memory
+    size_t logCap;  // mapped size of the log file
+} outputRing;
+
 // processRecord - a struct type to be used for job records in the job table
 // The job table is to be implemented as a doubly linked list - for this reason, we have 'prev' and 'next' pointers
 typedef struct processRecord {
     char* command;  // Path to the executable
     pid_t pid;
+    int pidfd;  // the pidfd referring to the process (see pidfd_open()); -1 if the kernel doesn't support pidfds
     int exitCode;   // Last exit code returned by the process
     processStatus status;   // Current execution status, according to the enum defined above
     int background; // background flag; non-zero if the process is in the background
+    schedOptions sched; // scheduling settings applied to the process (CPU affinity, nice value, I/O priority)
+    limitOptions limits;    // resource limits applied to the process
+    int limitHit;   // the limit (LIMIT_...) which ended the job, as far as it can be told; LIMIT_NONE if none
+    int timed;  // if not TIME_NONE, the resource usage of the job is reported in this format when it finishes
+    double started; // when the job was launched (CLOCK_MONOTONIC, in seconds)
+    int perfFds[PERF_COUNTERS]; // software performance counters of the job (see openPerfCounters()); -1 if not open
+    struct rusage usage;    // resource usage of the job, as reported by wait4() when it finished
+    int statusSlot; // index of the pending status update of the process in the status updates buffer (or one of the STATUS_SLOT_... values)
+    int outFd;  // read end of the pipe with the output of the job, if it is captured ('capture', server mode); -1 otherwise
+    outputRing* output; // the captured output of the job ('capture'); NULL if it is not captured
+    unsigned int jobId; // stable job ID: unlike the job number, it never changes (see seashell-top; the server mode numbers the jobs per session)
+    clockid_t cpuClock; // the CPU-time clock of the process (see clock_getcpuclockid())
+    int timeoutStage;   // one of the TIMEOUT_... values
+    double deadline;    // when the next stage of the timeout is due (CLOCK_MONOTONIC, in seconds)
+    double killAfter;   // seconds from SIGTERM to SIGKILL; 0 if SIGKILL is not to be sent
+    int deadlineSlot;   // index of the job in the deadline heap; -1 if it is not there
 
     struct processRecord* prev;
     struct processRecord* next;
@@ -48,23 +191,34 @@ processRecord* procs = NULL;    // Pointer to the first record (the head) of the
 processRecord* currentProc = NULL;  // This is the pointer to the record of the process that is currently in the foreground.
                                     // Respectively, if there's no process in the foreground, this is NULL
 unsigned int nextJobNum = 1;    // size(job table) + 1
+unsigned int lastJobId = 0; // stable ID of the last launched job (see processRecord.jobId)
 
 // statusUpdateItem - a struct type for the status updates generated by the updateStatus() function.
-// Whenever the updateStatus() function discovers that a process terminated/stopped, it generates a
-// struct of this type and places it into the status updates buffer (which is to be implemented as a queue modelled on the linked list)
-// flushStatusBuffer() function flushes the status updates buffer and prints respective diagnostic status updates messages based on the contents of the buffer.
+// Whenever the updateStatus() function discovers that a process terminated/stopped, it places an item of this type into the status updates buffer.
+// The buffer is a preallocated ring of STATUS_RING_SIZE items, so that no memory is allocated per update. There is never more than one item per job:
+// if the job already has an item in the ring, the item is overwritten with the latest status (the updates are coalesced).
+// flushStatusBuffer() function flushes the status updates buffer and prints one diagnostic status update message per job based on the contents of the buffer.
 typedef struct statusUpdateItem {
     processRecord* proc;    // the record of the respective process
     int exitCode;   // the exit code at the moment of generating the update
     processStatus s;    // execution status at the moment of generating the update
     int backgr; // background flag at the moment of generating the update
     unsigned int jobNum;    // job number - used for printing messages; stored here to avoid calculating it several times for the same reason
-
-    struct statusUpdateItem* next;  // next item in the linked list
+    unsigned int updates;   // number of status updates coalesced into this item
 } statusUpdateItem;
 
-statusUpdateItem* statusBuffer = NULL;  // First item in the status updates buffer/queue (head)
-statusUpdateItem* statusBufferTail = NULL;  // Last item in the status updates buffer/queue (tail)
+#define STATUS_RING_SIZE 64 // Capacity of the status updates buffer
+#define STATUS_SLOT_NONE (-1)   // processRecord.statusSlot: the job has no item in the status updates buffer
+#define STATUS_SLOT_DROPPED (-2)    // processRecord.statusSlot: the buffer was full, so the update of the job was dropped
+
+// The ring has a single producer (pushStatusBuffer()) and a single consumer (flushStatusBuffer()), and the positions only grow,
+// so no locks are needed. The fences keep the compiler from moving the stores of an item past the publication of the tail (and the
+// reads of an item past the advance of the head). Both sides run in the main flow of the shell: the producer is not signal-safe,
+// as it also updates an item that is already published (a second update of the same job is coalesced into it).
+statusUpdateItem statusBuffer[STATUS_RING_SIZE];
+volatile unsigned int statusBufferHead = 0; // Position of the first item in the buffer (advanced by the consumer)
+volatile unsigned int statusBufferTail = 0; // Position after the last item in the buffer (advanced by the producer)
+volatile unsigned int statusOverflow = 0;   // Number of updates dropped since the last flush because the buffer was full
 
 // printAbout() - prints general information about the program; called at the startup
 void printAbout() {
@@ -87,23 +241,77 @@ void printHelp() {
 
     printf("Built-in commands:\n");
 
-    printf("%-5s    %s\n", "bg", "Resume a job in the background;");
-    printf("%-5s    %s\n", "", "supply the job number in the first argument.");
-    printf("%-5s    %s\n", "", "See also the \"Job Control\" section of this help message.\n");
+    printf("%-8s    %s\n", "bg", "Resume a job in the background;");
+    printf("%-8s    %s\n", "", "supply the job number in the first argument. \"bg --timeout DURATION [--kill-after DURATION] N\"");
+    printf("%-8s    %s\n", "", "also sets a new deadline of the job, counted from now (see \"run\"); a zero timeout removes it.");
+    printf("%-8s    %s\n", "", "See also the \"Job Control\" section of this help message.\n");
+
+    printf("%-8s    %s\n", "bgpolicy", "Set the scheduling settings applied to every job started with '&',");
+    printf("%-8s    %s\n", "", "using the same options as \"run\"; \"bgpolicy off\" removes the policy.");
+    printf("%-8s    %s\n", "", "Without arguments, prints the current policy.\n");
+
+    printf("%-8s    %s\n", "capture", "\"capture on\" sends the output of the jobs started with '&' to in-memory buffers");
+    printf("%-8s    %s\n", "", "(the last 64 KiB of every job are kept) instead of the terminal; \"capture on --log\"");
+    printf("%-8s    %s\n", "", "also keeps the whole output in log files in $TMPDIR. \"capture off\" stops capturing");
+    printf("%-8s    %s\n", "", "the output of new jobs. See also \"output\"; \"fg\" replays the captured output.\n");
+
+    printf("%-8s    %s\n", "cd", "Change working directory; the path to the new working");
+    printf("%-8s    %s\n", "", "directory should be supplied as the first argument.\n");
+
+    printf("%-8s    %s\n", "exit", "Exit the shell. Instead, you can press Ctrl-D.\n");
+
+    printf("%-8s    %s\n", "false", "Do nothing, unsuccessfully: the exit status ($?) becomes 1.\n");
+
+    printf("%-8s    %s\n", "fg", "Resume a job in/bring a job to the foreground;");
+    printf("%-8s    %s\n", "", "supply the job number in the first argument. The timeout options are the same as for \"bg\".");
+    printf("%-8s    %s\n", "", "See also the \"Job Control\" section of this help message.\n");
+
+    printf("%-8s    %s\n", "help", "Display this help message.\n");
+
+    printf("%-8s    %s\n", "jobs", "Display all the jobs currently controlled by this instance of Sea Shell.");
+    printf("%-8s    %s\n", "", "See also the \"Job Control\" section of this help message.\n");
+
+    printf("%-8s    %s\n", "let", "Evaluate arithmetic expressions: \"let expression...\"; see the \"Control Flow and");
+    printf("%-8s    %s\n", "", "Variables\" section of this help message.\n");
+
+    printf("%-8s    %s\n", "output", "Show the captured output of a job: \"output job_number [--tail lines] [--follow]\".");
+    printf("%-8s    %s\n", "", "--follow keeps showing the output as it comes, until the job ends or Ctrl-C is pressed.");
+    printf("%-8s    %s\n", "", "A finished job stays in the job table until its captured output is shown.\n");
+
+    printf("%-8s    %s\n", "renice", "Change the scheduling settings of a running/stopped job: \"renice job_number");
+    printf("%-8s    %s\n", "", "[options]\", with the same scheduling options as \"run\". The nice value and the I/O");
+    printf("%-8s    %s\n", "", "priority are applied to the whole process group of the job.\n");
 
-    printf("%-5s    %s\n", "cd", "Change working directory; the path to the new working");
-    printf("%-5s    %s\n", "", "directory should be supplied as the first argument.\n");
+    printf("%-8s    %s\n", "run", "Run an external command with the given scheduling settings:");
+    printf("%-8s    %s\n", "", "\"run [--cpus 0-3,6] [--nice -20..19] [--ioprio idle|be[:0-7]|rt[:0-7]] command\".");
+    printf("%-8s    %s\n", "", "--timeout DURATION (e.g. 30s, 500ms, 5m, 2h) sends SIGTERM to the process group of the job");
+    printf("%-8s    %s\n", "", "when the time is up, and --kill-after DURATION sends SIGKILL that much later; such a job is");
+    printf("%-8s    %s\n", "", "reported as 'Timed out', and its exit status ($?) is 124. Resource limits: --mem SIZE (address");
+    printf("%-8s    %s\n", "", "space), --nofile N (open files), --cpu DURATION (CPU time, whole seconds) and --fsize SIZE (largest");
+    printf("%-8s    %s\n", "", "file written), e.g. \"run --mem 2G --nofile 4096 command\"; SIZE may end with K, M, G or T, and");
+    printf("%-8s    %s\n", "", "\"unlimited\" is accepted too. A job ended by its limit is reported with the reason; if a limit");
+    printf("%-8s    %s\n", "", "cannot be set, the command is not run at all (its exit status is 126).");
+    printf("%-8s    %s\n", "", "The settings are shown by \"jobs\".\n");
 
-    printf("%-5s    %s\n", "exit", "Exit the shell. Instead, you can press Ctrl-D.\n");
+    printf("%-8s    %s\n", "time", "Run a command and report the real time, the user/system CPU time, page faults,");
+    printf("%-8s    %s\n", "", "context switches and (where the kernel allows) the task clock from performance");
+    printf("%-8s    %s\n", "", "counters: \"time [-p] command\". Works with external commands, \"run\", background");
+    printf("%-8s    %s\n", "", "jobs (reported when they finish) and \"fg\" (the time in the foreground is reported).");
+    printf("%-8s    %s\n", "", "-p prints the POSIX format; otherwise, the TIMEFORMAT environment variable may give");
+    printf("%-8s    %s\n", "", "the format: %R real, %U user, %S system (seconds), %P CPU percentage, %f/%F minor/major");
+    printf("%-8s    %s\n", "", "faults, %c/%w voluntary/involuntary switches, %T task clock (ms), %C context switches");
+    printf("%-8s    %s\n", "", "and %M page faults (from the counters), %% - the percent sign.\n");
 
-    printf("%-5s    %5s\n", "fg", "Resume a job in/bring a job to the foreground;");
-    printf("%-5s    %s\n", "", "supply the job number in the first argument.");
-    printf("%-5s    %s\n", "", "See also the \"Job Control\" section of this help message.\n");
+    printf("%-8s    %s\n", "true, :", "Do nothing, successfully: the exit status ($?) becomes 0.\n");
 
-    printf("%-5s    %s\n", "help", "Display this help message.\n");
+    printf("%-8s    %s\n", "ulimit", "Set the resource limits applied to every job which doesn't set its own, using the same");
+    printf("%-8s    %s\n", "", "options as \"run\" (e.g. \"ulimit --mem 2G --cpu 10m\"); \"unlimited\" removes one limit,");
+    printf("%-8s    %s\n", "", "and \"ulimit off\" removes all of them. Without arguments, prints the current limits.\n");
 
-    printf("%-5s    %s\n", "jobs", "Display all the jobs currently controlled by this instance of Sea Shell.");
-    printf("%-5s    %s\n", "", "See also the \"Job Control\" section of this help message.\n");
+    printf("%-8s    %s\n", "wait", "Wait until the given jobs (all the jobs if no job numbers are given)");
+    printf("%-8s    %s\n", "", "finish; \"wait -n [job_numbers]\" waits for any one of them. Stopped jobs");
+    printf("%-8s    %s\n", "", "are not waited for. Press Ctrl-C to stop waiting. The exit status ($?) is the one");
+    printf("%-8s    %s\n", "", "of the last job that finished (124 if it timed out).\n");
 
     printf("All other commands are treated as external, thus the name of the command\n%s",
         "is to be treated as the path to an executable.\n\n");
@@ -124,6 +332,13 @@ void printHelp() {
         "will also appear in the parameter and will not be seen as double quotes).\n",
         "'\\' character can be escaped itself (i.e. '\\\\' results in '\\').\n\n");
     
+    printf("The standard input of an external command can be supplied in the command line itself:\n%s%s%s%s%s",
+        "\"command <<DELIM\" (here-document) reads the following lines, up to the line \"DELIM\",\n",
+        "and feeds them to the command; with \"<<-DELIM\", the leading tabs of those lines are removed.\n",
+        "\"command <<<word\" (here-string) feeds the word followed by a newline.\n",
+        "No temporary files are created: small inputs are passed through a pipe, and large ones\n",
+        "through a sealed in-memory file.\n\n");
+
     printf("Examples:\n\n");
 
     printf("%-20s    %s\n", "mkdir foo bar", "2 folders created: foo and bar;");
@@ -154,9 +369,10 @@ void printHelp() {
     printf("%-42s    %s\n", "Continue a suspended job in the foreground", "Type \"fg job_number\"\n");
     printf("%-42s    %s\n", "Bring a background job to the foreground", "Type \"fg job_number\"\n");
 
-    printf("\nEvery time before the shell prints the command prompt, it will notify you if\n%s%s",
+    printf("\nEvery time before the shell prints the command prompt, it will notify you if\n%s%s%s",
         "the execution status of any job has changed since the previous prompt was displayed.\n",
-        "After every such update, all the jobs that have been marked as 'Done' are forgotten.\n\n");
+        "After every such update, all the jobs that have been marked as 'Done' are forgotten.\n",
+        "If the status of a job changed several times, only the latest status is shown.\n\n");
 
     printf("Both the \"jobs\" command and the real-time status updates share the same\n%s",
         "format of the process record information:\n\n");
@@ -168,6 +384,61 @@ void printHelp() {
         "5) Path to the executable\n",
         "6) If the process is in background: &\n");
 
+    printf("\nThe job table is also published in the shared memory object /dev/shm/seashell-top-PID (PID of the shell),\n%s%s%s",
+        "with a stable ID, the status, the start time and the CPU time of every job. The companion program seashell-top\n",
+        "(built from seashell-top.c) shows the jobs of all the running shells; see \"seashell-top -h\" for the options.\n",
+        "The CPU times are updated every second while some job is running.\n");
+
+    printf("\n\n    ==== Control Flow and Variables ====\n\n");
+
+    printf("Several commands can be given in one line, separated with ';' (an escaped or quoted ';'\n%s%s%s%s%s%s%s",
+        "is an ordinary character). The following constructs are supported, and each of them may span\n",
+        "several lines (the shell prompts for the rest with \"> \"):\n\n",
+        "    if commands; then commands; [elif commands; then commands;] [else commands;] fi\n",
+        "    while commands; do commands; done\n",
+        "    for NAME in words; do commands; done\n\n",
+        "A condition is true when the exit status of its last command is 0; \"true\", \"false\" and \":\"\n",
+        "are built-in, so loops that only use them (and assignments) do not start any processes.\n\n");
+
+    printf("\"NAME=value\" sets a shell variable. \"$NAME\" or \"${NAME}\" is replaced with the value\n%s%s%s%s",
+        "of the variable (or of the environment variable with that name); \"$?\" - with the exit status\n",
+        "of the last command, \"$$\" - with the PID of the shell. A reference to an unset variable that\n",
+        "forms a whole word is removed. \"\\$\" results in '$'. The values in the list of \"for\"\n",
+        "are split at whitespaces once they are expanded.\n\n");
+
+    printf("\"$(( expression ))\" is replaced with the value of the expression, computed by the shell itself\n%s%s%s%s%s",
+        "with 64-bit integers: the C operators (including ?:, assignments such as += and ++/--) and ** are\n",
+        "supported, numbers may be octal (010) or hexadecimal (0x10), and variables are used by their names\n",
+        "(e.g. \"$(( i * 2 + 1 ))\"). The \"let\" built-in command evaluates each of its arguments (e.g.\n",
+        "let i++ or let \"i = i + 1\"); its exit status is 0 if the last value is not 0, so it also works\n",
+        "as a loop condition. Every expression is parsed only once, so arithmetic in loops is cheap.\n");
+
+    printf("\n\n    ==== Scripts ====\n\n");
+
+    printf("\"seashell script_file\" executes the commands from the script file, one command line\n%s%s%s%s",
+        "per line, just as if they were typed at the command prompt. Empty lines and lines starting\n",
+        "with '#' are skipped. The parsed script is cached in $SEASHELL_CACHE_DIR (by default,\n",
+        "~/.cache/seashell), so an unchanged script is not parsed again the next time it is run.\n",
+        "The cache is keyed by the identity of the file (device, inode, size, modification time).\n");
+
+    printf("\"seashell -c command_line\" executes a single command line and exits (e.g. SHELL=seashell\n%s%s%s%s",
+        "for make). If the last command of the line is a simple external command, nothing else is printed\n",
+        "for it, and it replaces the shell instead of being run in a child process, so its exit code\n",
+        "becomes the exit code of the shell. Built-in commands, background jobs and the other commands\n",
+        "of the line are executed as usual.\n");
+
+    printf("\n\n    ==== Server Mode ====\n\n");
+
+    printf("\"seashell --serve socket_path\" listens on a Unix domain socket and executes the command\n%s%s%s%s%s%s%s%s%s",
+        "lines sent by any number of concurrent clients. Every client session has its own working\n",
+        "directory and job table. The output of the commands is streamed back, and every job is\n",
+        "concluded with a status line: [exit N] or [signal N] for foreground jobs, [J] exit N or\n",
+        "[J] signal N for background job J (announced by [J] PID=P started), or [error message].\n",
+        "The next command (commands may be separated with ';') is executed once the foreground job\n",
+        "finishes. Every session has its own shell variables and $?, which are expanded as usual,\n",
+        "including $(( )). The supported built-in commands are cd, jobs, run, exit, let, true, false\n",
+        "and :, plus assignments; if, while and for are not supported in this mode. The standard input\n",
+        "of the commands is /dev/null, unless a here-string (<<<) is given.\n");
     printf("\n\n    ==== Author Information ====\n\n");
     printf("I am Volodymyr Lapytskyi, a sophomore student at the\n%s%s%s",
         "American University in Bulgaria, majoring in\n",
@@ -179,6 +450,424 @@ void printHelp() {
     return;
 }
 
+/*
+ * initSchedOptions() - resets the scheduling settings, so that nothing is to be changed
+ */
+void initSchedOptions(schedOptions* o) {
+    o->cpuList = NULL;
+    CPU_ZERO(&o->cpus);
+    o->setNice = 0;
+    o->nice = 0;
+    o->ioprio = -1;
+}
+
+// freeSchedOptions() - frees the resources used by the scheduling settings (the copy of the CPU list)
+void freeSchedOptions(schedOptions* o) {
+    free(o->cpuList);
+    o->cpuList = NULL;
+}
+
+/*
+ * parseCpuList() - converts a CPU list of the form "0-3,6,8-9" into a CPU set
+ * Returns 0 on success, and -1 if the list is malformed.
+ */
+int parseCpuList(const char* str, cpu_set_t* set) {
+    const char* c = str;
+    char* end;
+    unsigned long from, to;
+
+    CPU_ZERO(set);
+    if (*c == '\0') return -1;
+
+    while (*c != '\0') {
+        if (*c < '0' || *c > '9') return -1;
+        from = strtoul(c, &end, 10);
+        to = from;
+        c = end;
+        if (*c == '-') {    // a range of CPUs
+            c++;
+            if (*c < '0' || *c > '9') return -1;
+            to = strtoul(c, &end, 10);
+            c = end;
+        }
+        if (to < from || to >= CPU_SETSIZE) return -1;
+        for (; from <= to; from++) CPU_SET(from, set);
+
+        if (*c == ',') {
+            c++;
+            if (*c == '\0') return -1;
+        }
+        else if (*c != '\0') return -1;
+    }
+    return 0;
+}
+
+/*
+ * parseIoprio() - converts an I/O priority of the form "class[:level]" into the value expected by ioprio_set()
+ * The class is one of "idle", "be" (best effort), "rt" (real time) or "none"; the level is 0..7 (0 is the highest).
+ * Returns -1 if the priority is malformed.
+ */
+int parseIoprio(const char* str) {
+    const char* level = strchr(str, ':');
+    size_t len = level ? (size_t) (level - str) : strlen(str);
+    int data = 4;   // the default level for the 'be' and 'rt' classes
+    char* end;
+
+    if (level != NULL) {
+        level++;
+        if (*level < '0' || *level > '7' || level[1] != '\0') return -1;
+        data = (int) strtol(level, &end, 10);
+    }
+
+    if (len == 4 && strncmp(str, "idle", 4) == 0 && level == NULL) return IOPRIO_PRIO_VALUE(IOPRIO_CLASS_IDLE, 0);
+    if (len == 4 && strncmp(str, "none", 4) == 0 && level == NULL) return IOPRIO_PRIO_VALUE(IOPRIO_CLASS_NONE, 0);
+    if (len == 2 && strncmp(str, "be", 2) == 0) return IOPRIO_PRIO_VALUE(IOPRIO_CLASS_BE, data);
+    if (len == 2 && strncmp(str, "rt", 2) == 0) return IOPRIO_PRIO_VALUE(IOPRIO_CLASS_RT, data);
+    return -1;
+}
+
+/*
+ * parseDuration() - converts a duration of the form "30s", "1.5m", "500ms" (a non-negative number followed by ms, s, m, h or d;
+ * seconds if there's no suffix) into seconds
+ * Returns 0 on success, and -1 if the duration is malformed.
+ */
+int parseDuration(const char* str, double* seconds) {
+    char* end;
+    double d;
+
+    if ((*str < '0' || *str > '9') && *str != '.') return -1;  // (strtod() would also take signs, "inf", "nan" etc.)
+    d = strtod(str, &end);
+    if (end == str) return -1;
+
+    if (*end == '\0' || strcmp(end, "s") == 0) *seconds = d;
+    else if (strcmp(end, "ms") == 0) *seconds = d / 1000;
+    else if (strcmp(end, "m") == 0) *seconds = d * 60;
+    else if (strcmp(end, "h") == 0) *seconds = d * 3600;
+    else if (strcmp(end, "d") == 0) *seconds = d * 86400;
+    else return -1;
+    return 0;
+}
+
+// initLimitOptions() - resets the resource limits, so that nothing is to be changed
+void initLimitOptions(limitOptions* l) {
+    int i;
+
+    for (i = 0; i < LIMITS; i++) {
+        l->set[i] = 0;
+        l->value[i] = RLIM_INFINITY;
+    }
+}
+
+// hasLimits() - returns non-zero if any of the resource limits is set
+int hasLimits(limitOptions* l) {
+    int i;
+
+    for (i = 0; i < LIMITS; i++) if (l->set[i]) return 1;
+    return 0;
+}
+
+/*
+ * parseLimitValue() - converts the value of a resource limit into the units of setrlimit()
+ * "unlimited" means no limit. The memory and file size limits are in bytes, with an optional K, M, G or T suffix (powers of 1024);
+ * the CPU time limit is a duration (see parseDuration()), rounded up to whole seconds; the number of open files is a plain number.
+ * Returns 0 on success, and -1 if the value is malformed.
+ */
+int parseLimitValue(int limit, const char* str, rlim_t* value) {
+    const char* suffixes = "KMGT";
+    const char* suffix;
+    unsigned long long n;
+    int shift = 0;  // the power of 1024 given by the suffix, as a bit shift
+    double seconds;
+    char* end;
+
+    if (strcmp(str, "unlimited") == 0) {
+        *value = RLIM_INFINITY;
+        return 0;
+    }
+    if (limit == LIMIT_CPU) {
+        if (parseDuration(str, &seconds) != 0 || seconds <= 0 || seconds >= (double) RLIM_INFINITY) return -1;
+        *value = (rlim_t) seconds;
+        if ((double) *value < seconds) (*value)++;
+        return 0;
+    }
+
+    if (*str < '0' || *str > '9') return -1;
+    errno = 0;
+    n = strtoull(str, &end, 10);
+    if (errno == ERANGE) return -1;
+    if (*end != '\0') {
+        if (limit == LIMIT_NOFILE || end[1] != '\0' || (suffix = strchr(suffixes, *end)) == NULL) return -1;
+        shift = 10 * (suffix - suffixes + 1);
+    }
+    // A value that doesn't fit (or would become RLIM_INFINITY) must not turn into some other limit, or into no limit at all
+    if (n == 0 || n > ((unsigned long long) RLIM_INFINITY - 1) >> shift) return -1;
+    n <<= shift;
+    *value = (rlim_t) n;
+    return 0;
+}
+
+/*
+ * mergeLimitOptions() - copies into 'dst' all the limits of 'src' that are not set in 'dst' yet
+ * Used to apply the limits of the 'ulimit' built-in command to the jobs which don't set their own.
+ */
+void mergeLimitOptions(limitOptions* dst, limitOptions* src) {
+    int i;
+
+    for (i = 0; i < LIMITS; i++) {
+        if (!dst->set[i] && src->set[i]) {
+            dst->set[i] = 1;
+            dst->value[i] = src->value[i];
+        }
+    }
+}
+
+/*
+ * applyLimitOptions() - sets the resource limits of the calling process (the child, just before execv())
+ * Both the soft and the hard limit are set, so that the command cannot raise the limit back; the hard CPU time limit is one second
+ * above the soft one, so that the command gets SIGXCPU before SIGKILL. A limit above the current hard limit can be set only
+ * by a privileged user. Returns 0 on success, and -1 if any of the limits could not be set (the reason is printed to stderr);
+ * then the callers don't run the command at all, as it would run without the cap.
+ */
+int applyLimitOptions(limitOptions* l) {
+    struct rlimit r, old;
+    int i, result = 0;
+
+    for (i = 0; i < LIMITS; i++) {
+        if (!l->set[i]) continue;
+        r.rlim_cur = r.rlim_max = l->value[i];
+        if (i == LIMIT_CPU && r.rlim_max != RLIM_INFINITY) {
+            r.rlim_max++;
+            if (getrlimit(limitResources[i], &old) == 0 && old.rlim_max != RLIM_INFINITY && r.rlim_max > old.rlim_max) {
+                r.rlim_max = old.rlim_max;  // (then SIGXCPU comes only if the soft limit is below it)
+                if (r.rlim_cur > r.rlim_max) r.rlim_cur = r.rlim_max;
+            }
+        }
+        if (setrlimit(limitResources[i], &r) != 0) {
+            fprintf(stderr, "Unable to set the %s limit: %s.\n", limitNames[i], strerror(errno));
+            result = -1;
+        }
+    }
+    return result;
+}
+
+// _printLimitValue() - outputs the value of a resource limit in the form accepted by parseLimitValue() (e.g. "2G", "30s")
+void _printLimitValue(int limit, rlim_t value) {
+    const char* suffixes = "KMGT";
+    int s = -1;
+
+    if (value == RLIM_INFINITY) printf("unlimited");
+    else if (limit == LIMIT_CPU) printf("%llus", (unsigned long long) value);
+    else if (limit == LIMIT_NOFILE) printf("%llu", (unsigned long long) value);
+    else {
+        while (s < 3 && value % 1024 == 0) {
+            value /= 1024;
+            s++;
+        }
+        printf("%llu", (unsigned long long) value);
+        if (s >= 0) printf("%c", suffixes[s]);
+    }
+}
+
+// _printLimitInfo() - outputs the resource limits in the form " mem=2G cpu=30s"; prints nothing if no limits are set
+void _printLimitInfo(limitOptions* l) {
+    int i;
+
+    for (i = 0; i < LIMITS; i++) {
+        if (!l->set[i]) continue;
+        printf(" %s=", limitNames[i]);
+        _printLimitValue(i, l->value[i]);
+    }
+}
+
+// _limitOption() - returns the resource limit (LIMIT_...) set by the option (e.g. "--mem"), or -1 if it is not such an option
+int _limitOption(const char* option) {
+    int i;
+
+    for (i = 0; i < LIMITS; i++) if (strncmp(option, "--", 2) == 0 && strcmp(option + 2, limitNames[i]) == 0) return i;
+    return -1;
+}
+
+/*
+ * parseSchedOptions() - parses the scheduling options (--cpus LIST, --nice N, --ioprio CLASS[:LEVEL]) of a built-in command
+ * Arguments:
+ * args - command line arguments;
+ * first - index of the first argument to be checked;
+ * o - the options are stored here;
+ * t - if not NULL, the timeout options (--timeout DURATION, --kill-after DURATION) are accepted too, and stored here;
+ * l - if not NULL, the resource limits (--mem SIZE, --nofile N, --cpu DURATION, --fsize SIZE) are accepted too, and stored here;
+ * cmdname - name of the built-in command, used in the error messages.
+ *
+ * Returns the index of the first argument which is not an option, or -1 if the options are malformed (the error message is printed).
+ */
+int parseSchedOptions(char** args, unsigned int first, schedOptions* o, timeoutOptions* t, limitOptions* l, const char* cmdname) {
+    unsigned int i = first;
+    int limit;
+    char* end;
+
+    if (t != NULL) {
+        t->set = 0;
+        t->timeout = 0;
+        t->killAfter = 0;
+    }
+
+    while (args[i] != NULL && strncmp(args[i], "--", 2) == 0) {
+        if (strcmp(args[i], "--") == 0) {   // explicit end of the options
+            i++;
+            break;
+        }
+
+        if (args[i + 1] == NULL) {
+            printf("%s: option %s requires an argument.\n", cmdname, args[i]);
+            return -1;
+        }
+
+        if (strcmp(args[i], "--cpus") == 0) {
+            if (parseCpuList(args[i + 1], &o->cpus) != 0) {
+                printf("%s: invalid CPU list [%s] (expected e.g. 0-3,6).\n", cmdname, args[i + 1]);
+                return -1;
+            }
+            free(o->cpuList);
+            o->cpuList = (char*) malloc(strlen(args[i + 1]) + 1);
+            if (!o->cpuList) {
+                fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+                exit(2);
+            }
+            strcpy(o->cpuList, args[i + 1]);
+        }
+        else if (strcmp(args[i], "--nice") == 0) {
+            long n = strtol(args[i + 1], &end, 10);
+            if (*args[i + 1] == '\0' || *end != '\0' || n < -20 || n > 19) {
+                printf("%s: invalid nice value [%s] (expected -20..19).\n", cmdname, args[i + 1]);
+                return -1;
+            }
+            o->setNice = 1;
+            o->nice = (int) n;
+        }
+        else if (strcmp(args[i], "--ioprio") == 0) {
+            if ((o->ioprio = parseIoprio(args[i + 1])) < 0) {
+                printf("%s: invalid I/O priority [%s] (expected idle, none, be[:0-7] or rt[:0-7]).\n", cmdname, args[i + 1]);
+                return -1;
+            }
+        }
+        else if (t != NULL && (strcmp(args[i], "--timeout") == 0 || strcmp(args[i], "--kill-after") == 0)) {
+            if (parseDuration(args[i + 1], args[i][2] == 't' ? &t->timeout : &t->killAfter) != 0) {
+                printf("%s: invalid duration [%s] (expected e.g. 30s, 500ms, 1.5m, 2h).\n", cmdname, args[i + 1]);
+                return -1;
+            }
+            if (args[i][2] == 't') t->set = 1;
+        }
+        else if (l != NULL && (limit = _limitOption(args[i])) >= 0) {
+            if (parseLimitValue(limit, args[i + 1], &l->value[limit]) != 0) {
+                printf("%s: invalid %s limit [%s] (expected e.g. %s, or unlimited).\n", cmdname, limitNames[limit], args[i + 1],
+                    limit == LIMIT_CPU ? "30s" : limit == LIMIT_NOFILE ? "4096" : "2G");
+                return -1;
+            }
+            l->set[limit] = 1;
+        }
+        else {
+            printf("%s: unknown option %s.\n", cmdname, args[i]);
+            return -1;
+        }
+        i += 2;
+    }
+
+    if (t != NULL && t->killAfter > 0 && !t->set) {
+        printf("%s: --kill-after requires --timeout.\n", cmdname);
+        return -1;
+    }
+    return i;
+}
+
+/*
+ * mergeSchedOptions() - copies into 'dst' all the settings of 'src' that are not set in 'dst' yet
+ * Used to apply the background policy to the jobs started with '&'.
+ */
+void mergeSchedOptions(schedOptions* dst, schedOptions* src) {
+    if (dst->cpuList == NULL && src->cpuList != NULL) {
+        dst->cpuList = (char*) malloc(strlen(src->cpuList) + 1);
+        if (!dst->cpuList) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+        strcpy(dst->cpuList, src->cpuList);
+        dst->cpus = src->cpus;
+    }
+    if (!dst->setNice && src->setNice) {
+        dst->setNice = 1;
+        dst->nice = src->nice;
+    }
+    if (dst->ioprio < 0) dst->ioprio = src->ioprio;
+}
+
+/*
+ * applySchedOptions() - applies the scheduling settings to a process
+ * Arguments:
+ * o - the settings;
+ * pid - PID of the targeted process (which is also the PGID of its process group); 0 means the calling process.
+ *
+ * If pid is 0, the settings are applied to the calling process (this is how the child applies them before execv());
+ * otherwise, the nice value and the I/O priority are applied to the whole process group of a live job.
+ * The CPU affinity is always applied to the process itself, since Linux has no process group variant of sched_setaffinity().
+ * Returns 0 on success, and -1 if any of the settings could not be applied (the reason is printed to stderr). The settings which
+ * could not be applied are removed from 'o', so that it holds only the ones which took effect.
+ */
+int applySchedOptions(schedOptions* o, pid_t pid) {
+    int result = 0;
+
+    if (o->cpuList != NULL && sched_setaffinity(pid, sizeof(cpu_set_t), &o->cpus) != 0) {
+        fprintf(stderr, "Unable to set the CPU affinity [%s]: %s.\n", o->cpuList, strerror(errno));
+        freeSchedOptions(o);
+        result = -1;
+    }
+    if (o->setNice && setpriority(pid ? PRIO_PGRP : PRIO_PROCESS, pid, o->nice) != 0) {
+        fprintf(stderr, "Unable to set the nice value %d: %s.\n", o->nice, strerror(errno));
+        o->setNice = 0;
+        result = -1;
+    }
+    if (o->ioprio >= 0 && syscall(SYS_ioprio_set, pid ? IOPRIO_WHO_PGRP : IOPRIO_WHO_PROCESS, pid, o->ioprio) != 0) {
+        fprintf(stderr, "Unable to set the I/O priority: %s.\n", strerror(errno));
+        o->ioprio = -1;
+        result = -1;
+    }
+    return result;
+}
+
+// _printSchedInfo() - outputs the scheduling settings in the form "cpus=0-3 nice=10 ioprio=idle"; prints nothing if no settings are set
+void _printSchedInfo(schedOptions* o) {
+    const char* classes[] = { "none", "rt", "be", "idle" };
+
+    if (o->cpuList != NULL) printf(" cpus=%s", o->cpuList);
+    if (o->setNice) printf(" nice=%d", o->nice);
+    if (o->ioprio >= 0) {
+        printf(" ioprio=%s", classes[IOPRIO_PRIO_CLASS(o->ioprio) & 3]);
+        if (IOPRIO_PRIO_CLASS(o->ioprio) == IOPRIO_CLASS_BE || IOPRIO_PRIO_CLASS(o->ioprio) == IOPRIO_CLASS_RT)
+            printf(":%d", IOPRIO_PRIO_DATA(o->ioprio));
+    }
+}
+
+// Reasons shown for the jobs ended by their resource limits (see limitHitBy())
+const char* limitHitReasons[LIMITS] = { "memory limit probably exceeded", "open files limit exceeded", "CPU time limit exceeded", "file size limit exceeded" };
+
+/*
+ * limitHitBy() - tells which resource limit (LIMIT_...) ended a finished job, or LIMIT_NONE
+ * SIGXCPU and SIGXFSZ are sent only for the CPU time and the file size limits. SIGKILL counts for the CPU time limit if the job
+ * used that much CPU time (the hard limit is just above the soft one). The memory limit makes the allocations fail instead, so
+ * it can only be guessed: a job with a memory limit which was killed by SIGKILL, SIGSEGV, SIGBUS or SIGABRT is suspected.
+ */
+int limitHitBy(processRecord* p) {
+    int sig;
+
+    if (!WIFSIGNALED(p->exitCode)) return LIMIT_NONE;
+    sig = WTERMSIG(p->exitCode);
+    if (sig == SIGXCPU && p->limits.set[LIMIT_CPU]) return LIMIT_CPU;
+    if (sig == SIGXFSZ && p->limits.set[LIMIT_FSIZE]) return LIMIT_FSIZE;
+    if (sig == SIGKILL && p->limits.set[LIMIT_CPU] && p->limits.value[LIMIT_CPU] != RLIM_INFINITY
+        && (rlim_t) (p->usage.ru_utime.tv_sec + p->usage.ru_stime.tv_sec) + 1 >= p->limits.value[LIMIT_CPU]) return LIMIT_CPU;
+    if ((sig == SIGKILL || sig == SIGSEGV || sig == SIGBUS || sig == SIGABRT) && p->limits.set[LIMIT_MEM]
+        && p->limits.value[LIMIT_MEM] != RLIM_INFINITY) return LIMIT_MEM;
+    return LIMIT_NONE;
+}
+
 /* _printProcInfo() - outputs the formatted information about a process; mostly, called by the flushStatusBuffer() function and the 'jobs' internal command
  * Arguments:
  * p - the record of the respective process;
@@ -191,798 +880,5224 @@ void printHelp() {
  * 1) [job_number]
  * 2) PID=process_ID
  * 3) execution_status
- * 4) If process is not running: (status last_execution_status)
+ * 4) If process is not running: (status last_execution_status), and the resource limit which ended it, if any
  * 5) Path to the executable
  * 6) If the process is in background: &
  */
-void _printProcInfo(processRecord* p, unsigned int jobNum, int backgr, processStatus s, int exitCode) {
+void _printProcLine(processRecord* p, unsigned int jobNum, int backgr, processStatus s, int exitCode) {
     // First, convert the processStatus enum into string...
     char status[] = "Terminated";
 
     if (s == running) strcpy(status, "Running");
     else if (s == stopped) strcpy(status, "Stopped");
     else if (s == done) strcpy(status, "Done");
+    else if (s == timedout) strcpy(status, "Timed out");
 
     // Now, output the info
     printf("[%d] PID=%d\t%s", jobNum, p->pid, status);
     if (s != running) printf(" (status %d)", exitCode);
+    if (s != running && s != stopped && p->limitHit != LIMIT_NONE) printf(" (%s)", limitHitReasons[p->limitHit]);
     printf("\t%s", p->command);
     if (backgr) printf(" &");
+}
+
+// exitStatusOf() - the exit status of a job as a command ($?): its exit code, 128+N if it was killed/stopped by the signal N,
+// or 124 if its deadline expired (as with timeout(1))
+int exitStatusOf(processRecord* p) {
+    if (p->status == timedout) return 124;
+    if (p->status == done) return WEXITSTATUS(p->exitCode);
+    if (p->status == terminated) return 128 + WTERMSIG(p->exitCode);
+    if (p->status == stopped) return 128 + WSTOPSIG(p->exitCode);
+    return 0;
+}
+
+// _printProcInfo() - the same as _printProcLine(), followed by the end of the line
+void _printProcInfo(processRecord* p, unsigned int jobNum, int backgr, processStatus s, int exitCode) {
+    _printProcLine(p, jobNum, backgr, s, exitCode);
     printf("\n");
 }
 
-/* flushStatusBuffer() - obtains all the records from the status updates buffer and prints respective diagnostic messages based on them.
- * Then, cleans all the resources for processes that have been marked as 'terminated' or 'done', and removes those processes from the job table.
- * Finally, empties the status updates buffer.
+/*
+ * ==== Timing (the 'time' built-in command) ====
+ *
+ * A timed job gets three software performance counters (task clock, context switches, page faults), opened with perf_event_open()
+ * while the child still waits on its semaphore; they are enabled by the execv() itself, so the shell's own work is not counted.
+ * If the kernel doesn't allow the counters (see /proc/sys/kernel/perf_event_paranoid), they are simply not reported.
+ * When the job finishes, its resource usage as reported by wait4() gives the user/system CPU time, page faults and context switches.
  */
-void flushStatusBuffer() {
-    statusUpdateItem* prev; // auxiliary variable
-
-    statusBufferTail = NULL;    // the tail is needed only for adding new items to the buffer, so we don't need it already
-
-    while (statusBuffer != NULL) {  // until the buffer is completely empty
-        // First, print the process info...
-        _printProcInfo(statusBuffer->proc, statusBuffer->jobNum, statusBuffer->backgr, statusBuffer->s, statusBuffer->exitCode);
-        // Then, if the job is terminated/done...
-        if (statusBuffer->proc->status == done || statusBuffer->proc->status == terminated) {
-            // a) Connect the neighbors of the processed job between each other, so that they don't remember the processed job.
-            //    i.e., we remove the process record from the job table.
-            if (statusBuffer->proc->next != NULL) { // If the item is not the last in the queue...
-                statusBuffer->proc->next->prev = statusBuffer->proc->prev;  // ...update the 'prev' pointer of the next item...
-            } else procs->prev = statusBuffer->proc->prev;  // ...otherwise, update the 'prev' pointer of the head
-            if (statusBuffer->proc == procs) {  // If the current item is being pointed to by the head, we need to update the head
-                procs = procs->next;
-            } else statusBuffer->proc->prev->next = statusBuffer->proc->next;   // If it is not in the head, update the 'next' pointer of the previous item
-                                                                                // (if it is in the head, the 'next' pointer of the item pointed to by 'prev'
-                                                                                // should always stay NULL, since it is the last item)
-
-            // b) We unlink the named semaphore that was used at the time of creating the process
-            char* semname = (char*) malloc(33); // Name of the semaphore. It should be of the form '/seashell10_childPID'
-            if (!semname) {
-                fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
-                exit(2);
-            }
-            if (sprintf(semname, "/seashell10_%d", statusBuffer->proc->pid) < 0) {
-                fprintf(stderr, "FATAL ERROR (UNKNOWN): Unable to create the name for the semaphore while deleting a process. Terminating...\n");
-                exit(3);
-            }
 
-            if (sem_unlink(semname) != 0) {
-                fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to unlink the semaphore. Terminating...\n");
-                exit(3);
-            }
+// timeSample - resource usage of a job (or of the shell itself) at some moment
+typedef struct timeSample {
+    double real;    // wall clock time (CLOCK_MONOTONIC), in seconds
+    double user;    // user CPU time, in seconds
+    double sys; // system CPU time, in seconds
+    long minflt, majflt;    // minor/major page faults
+    long nvcsw, nivcsw; // voluntary/involuntary context switches (-1 if unknown)
+    long long perf[PERF_COUNTERS];  // values of the performance counters; -1 if unavailable
+} timeSample;
+
+// monotonicNow() - returns the current CLOCK_MONOTONIC time in seconds
+double monotonicNow() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * openPerfCounters() - opens the software performance counters of a job; the counters that cannot be opened stay -1
+ * Arguments:
+ * p - the job record; the counters are stored in p->perfFds
+ * onExec - if non-zero, the counters start at the next execv() of the process (for new jobs); otherwise, they start immediately
+ */
+void openPerfCounters(processRecord* p, int onExec) {
+    const unsigned long long configs[PERF_COUNTERS] = { PERF_COUNT_SW_TASK_CLOCK, PERF_COUNT_SW_CONTEXT_SWITCHES, PERF_COUNT_SW_PAGE_FAULTS };
+    struct perf_event_attr attr;
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (p->perfFds[i] >= 0) continue;   // already open
+        memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_SOFTWARE;
+        attr.size = sizeof(attr);
+        attr.config = configs[i];
+        attr.inherit = 1;   // count the children of the job too
+        attr.disabled = onExec ? 1 : 0;
+        attr.enable_on_exec = onExec ? 1 : 0;
+        p->perfFds[i] = (int) syscall(SYS_perf_event_open, &attr, p->pid, -1, -1, PERF_FLAG_FD_CLOEXEC);
+    }
+}
 
-            // c) We free all the resources used for maintaining the process, and finally delete the record and decrease the job table size
-            free(semname);
-            free(statusBuffer->proc->command);
-            free(statusBuffer->proc);
-            nextJobNum--;
+// closePerfCounters() - closes the performance counters of a job
+void closePerfCounters(processRecord* p) {
+    int i;
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        if (p->perfFds[i] >= 0) close(p->perfFds[i]);
+        p->perfFds[i] = -1;
+    }
+}
+
+/*
+ * _readProcUsage() - reads the resource usage of a live process from /proc/PID/stat and /proc/PID/status
+ * (including its reaped children, like wait4() does). Used when a job is timed while it is still alive ('time fg').
+ */
+void _readProcUsage(pid_t pid, timeSample* s) {
+    char path[64];
+    char buf[1024];
+    char* c;
+    ssize_t n;
+    int fd;
+    unsigned long minflt, cminflt, majflt, cmajflt, utime, stime, cutime, cstime;
+    double tick = (double) sysconf(_SC_CLK_TCK);
+
+    sprintf(path, "/proc/%d/stat", pid);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) >= 0) {
+        n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (n > 0) {
+            buf[n] = '\0';
+            // The fields after the command name (which is in parentheses and may contain anything): state ppid pgrp session tty_nr tpgid flags
+            // minflt cminflt majflt cmajflt utime stime cutime cstime
+            if ((c = strrchr(buf, ')')) != NULL && sscanf(c + 1, " %*c %*d %*d %*d %*d %*d %*u %lu %lu %lu %lu %lu %lu %lu %lu",
+                    &minflt, &cminflt, &majflt, &cmajflt, &utime, &stime, &cutime, &cstime) == 8) {
+                s->minflt = minflt + cminflt;
+                s->majflt = majflt + cmajflt;
+                s->user = (utime + cutime) / tick;
+                s->sys = (stime + cstime) / tick;
+            }
         }
+    }
 
-        // Finally, we get rid of the current status update item, and move on to process the next one
-        prev = statusBuffer;
-        statusBuffer = statusBuffer->next;
-        free(prev);
+    sprintf(path, "/proc/%d/status", pid);
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) >= 0) {
+        n = read(fd, buf, sizeof(buf) - 1);
+        close(fd);
+        if (n > 0) {
+            buf[n] = '\0';
+            if ((c = strstr(buf, "\nvoluntary_ctxt_switches:")) != NULL) s->nvcsw = strtol(c + 25, NULL, 10);
+            if ((c = strstr(buf, "\nnonvoluntary_ctxt_switches:")) != NULL) s->nivcsw = strtol(c + 28, NULL, 10);
+        }
     }
 }
 
-/* pushStatusBuffer() - creates a new struct of the type statusUpdateItem and places it into the status updates buffer; called by updateStatus().
- * Arguments:
- * p - process record;
- * jobN - job number.
- * 
- * The update item is created mainly based on the information currently contained in the p.
+/*
+ * sampleJob() - takes a sample of the resource usage of a job
+ * For a finished job, the usage reported by wait4() is used; for a live one, the usage is read from /proc.
  */
-void pushStatusBuffer(processRecord* p, unsigned int jobN) {
-    // Allocate memory for the new status update item...
-    statusUpdateItem* newI = (statusUpdateItem*) malloc(sizeof(statusUpdateItem));
-    if (!newI) {
-        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
-        exit(2);
+void sampleJob(processRecord* p, timeSample* s) {
+    long long value;
+    int i;
+
+    memset(s, 0, sizeof(timeSample));
+    s->real = monotonicNow();
+    s->nvcsw = s->nivcsw = -1;
+
+    if (p->status == done || p->status == terminated || p->status == timedout) {
+        s->user = p->usage.ru_utime.tv_sec + p->usage.ru_utime.tv_usec / 1e6;
+        s->sys = p->usage.ru_stime.tv_sec + p->usage.ru_stime.tv_usec / 1e6;
+        s->minflt = p->usage.ru_minflt;
+        s->majflt = p->usage.ru_majflt;
+        s->nvcsw = p->usage.ru_nvcsw;
+        s->nivcsw = p->usage.ru_nivcsw;
     }
+    else _readProcUsage(p->pid, s);
 
-    // Next, fill the status update item with the relevant information...
-    newI->proc = p;
-    newI->jobNum = jobN;
-    newI->exitCode = p->exitCode;
-    newI->backgr = p->background;
-    newI->s = p->status;
-    newI->next = NULL;
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        s->perf[i] = -1;
+        if (p->perfFds[i] >= 0 && read(p->perfFds[i], &value, sizeof(value)) == sizeof(value)) s->perf[i] = value;
+    }
+}
+
+// sampleSelf() - takes a sample of the resource usage of the shell itself (for timing the built-in commands)
+void sampleSelf(timeSample* s) {
+    struct rusage ru;
+    int i;
+
+    memset(s, 0, sizeof(timeSample));
+    s->real = monotonicNow();
+    if (getrusage(RUSAGE_SELF, &ru) == 0) {
+        s->user = ru.ru_utime.tv_sec + ru.ru_utime.tv_usec / 1e6;
+        s->sys = ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+        s->minflt = ru.ru_minflt;
+        s->majflt = ru.ru_majflt;
+        s->nvcsw = ru.ru_nvcsw;
+        s->nivcsw = ru.ru_nivcsw;
+    }
+    for (i = 0; i < PERF_COUNTERS; i++) s->perf[i] = -1;
+}
 
-    // Finally, place the status update item into the buffer.
-    if (statusBuffer == NULL) { // If the queue is empty, the current item will be the first one...
-        statusBuffer = newI;
+/*
+ * printTimeReport() - prints the difference between two samples to stderr
+ * Arguments:
+ * from, to - the samples
+ * format - TIME_POSIX for the POSIX format ("real 1.00" etc.); TIME_DEFAULT for the format given by the TIMEFORMAT environment variable,
+ * or for the default human-readable format if TIMEFORMAT is not set.
+ *
+ * TIMEFORMAT may contain: %R - real time, %U - user CPU time, %S - system CPU time (all in seconds), %P - CPU percentage,
+ * %f/%F - minor/major page faults, %c/%w - voluntary/involuntary context switches,
+ * %T - task clock (ms), %C - context switches, %M - page faults (the last three come from the performance counters; -1 if unavailable),
+ * %% - the '%' character.
+ */
+void printTimeReport(timeSample* from, timeSample* to, int format) {
+    double real = to->real - from->real, user = to->user - from->user, sys = to->sys - from->sys;
+    long minflt = to->minflt - from->minflt, majflt = to->majflt - from->majflt;
+    long nvcsw = (to->nvcsw >= 0 && from->nvcsw >= 0) ? to->nvcsw - from->nvcsw : -1;
+    long nivcsw = (to->nivcsw >= 0 && from->nivcsw >= 0) ? to->nivcsw - from->nivcsw : -1;
+    long long perf[PERF_COUNTERS];
+    char* tf = getenv("TIMEFORMAT");
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++) perf[i] = (to->perf[i] >= 0 && from->perf[i] >= 0) ? to->perf[i] - from->perf[i] : -1;
+
+    if (format == TIME_POSIX) {
+        fprintf(stderr, "real %.2f\nuser %.2f\nsys %.2f\n", real, user, sys);
+    }
+    else if (tf != NULL) {  // TIMEFORMAT
+        for (; *tf != '\0'; tf++) {
+            if (*tf != '%' || tf[1] == '\0') {
+                fputc(*tf, stderr);
+                continue;
+            }
+            switch (*++tf) {
+                case 'R': fprintf(stderr, "%.3f", real); break;
+                case 'U': fprintf(stderr, "%.3f", user); break;
+                case 'S': fprintf(stderr, "%.3f", sys); break;
+                case 'P': fprintf(stderr, "%.1f", real > 0 ? (user + sys) * 100 / real : 0.0); break;
+                case 'f': fprintf(stderr, "%ld", minflt); break;
+                case 'F': fprintf(stderr, "%ld", majflt); break;
+                case 'c': fprintf(stderr, "%ld", nvcsw); break;
+                case 'w': fprintf(stderr, "%ld", nivcsw); break;
+                case 'T': fprintf(stderr, "%.3f", perf[PERF_TASK_CLOCK] >= 0 ? perf[PERF_TASK_CLOCK] / 1e6 : -1.0); break;
+                case 'C': fprintf(stderr, "%lld", perf[PERF_CONTEXT_SWITCHES]); break;
+                case 'M': fprintf(stderr, "%lld", perf[PERF_PAGE_FAULTS]); break;
+                case '%': fputc('%', stderr); break;
+                default: fputc('%', stderr); fputc(*tf, stderr); break;
+            }
+        }
+        fputc('\n', stderr);
     }
     else {
-        statusBufferTail->next = newI;  // ...otherwise, it will be the next after the tail
+        fprintf(stderr, "\n%-12s%dm%.3fs\n", "real", (int) (real / 60), real - 60 * (int) (real / 60));
+        fprintf(stderr, "%-12s%dm%.3fs\n", "user", (int) (user / 60), user - 60 * (int) (user / 60));
+        fprintf(stderr, "%-12s%dm%.3fs\n", "sys", (int) (sys / 60), sys - 60 * (int) (sys / 60));
+        fprintf(stderr, "%-12s%ld minor, %ld major\n", "faults", minflt, majflt);
+        if (nvcsw >= 0) fprintf(stderr, "%-12s%ld voluntary, %ld involuntary\n", "switches", nvcsw, nivcsw);
+        if (perf[PERF_TASK_CLOCK] >= 0) {
+            fprintf(stderr, "%-12s%.3f ms task-clock", "counters", perf[PERF_TASK_CLOCK] / 1e6);
+            if (perf[PERF_CONTEXT_SWITCHES] >= 0) fprintf(stderr, ", %lld context-switches", perf[PERF_CONTEXT_SWITCHES]);
+            if (perf[PERF_PAGE_FAULTS] >= 0) fprintf(stderr, ", %lld page-faults", perf[PERF_PAGE_FAULTS]);
+            fprintf(stderr, "\n");
+        }
     }
+}
 
-    statusBufferTail = newI;    // The tail should always contain the pointer to the last record
+/*
+ * reportJobTime() - prints the resource usage of a timed job from its launch until now, and stops timing it
+ * Called when a timed job finishes.
+ */
+void reportJobTime(processRecord* p) {
+    timeSample from, to;
+    int i;
+
+    sampleJob(p, &to);
+    memset(&from, 0, sizeof(from)); // The job started from nothing...
+    from.real = p->started; // ...at the moment of its launch
+    for (i = 0; i < PERF_COUNTERS; i++) from.perf[i] = 0;
+
+    printTimeReport(&from, &to, p->timed);
+    p->timed = TIME_NONE;
+    closePerfCounters(p);
 }
 
 /*
- * updateStatus() - detects any changes in the execution status of the children and updates the job table correspondingly.
- * Also, implements a busy wait in a case a process is running in the foreground.
- * Called in several places of this code in cases when the children need to be watched and/or all the
- * recent changes in the children's statuses need to be detected and/or we need to wait until a foreground process stops/terminates.
+ * ==== Deadlines (the --timeout option of 'run', 'fg' and 'bg') ====
+ *
+ * A job with a deadline gets SIGTERM (followed by SIGCONT, in case it is stopped) when the deadline expires, and with --kill-after,
+ * SIGKILL that much later; the signals go to the whole process group of the job. All the deadlines are kept in one binary min-heap,
+ * and a single timerfd is armed for the earliest of them, so the shell wakes up only when something is due. The timerfd is polled
+ * wherever the shell would otherwise sleep - at the command prompt, while a foreground job runs, in 'wait' (see pollWithCapture()).
+ * A job that finishes after its deadline has expired is reported as 'Timed out', and its exit status ($?) is 124.
  */
-void updateStatus() {
-    int status; // auxiliary variable used for storing the process' exit code as detected by waitpid()
-    pid_t proc = waitpid(WAIT_ANY, &status, WNOHANG | WUNTRACED);   // See if any child processes have stopped/terminated recently
 
-    while (1) {
-        while (proc != 0) { // The loop breaks when there are processes to wait for, but none of them has stopped/terminated
-            if (proc < 0) { // Some error has occurred...
-                if (errno == ECHILD) break; // Not a real error; we just don't have any processes to wait for; in this case, updateStatus() will just return
-                // Otherwise, we don't know what happened, but it was something bad
-                fprintf(stderr, "\nFATAL ERROR (UNKNOWN): waitpid() system call failed. Terminating...\n");
-                exit(3);
-            }
+int deadlineTimer = -1; // the timerfd armed for the earliest deadline; created with the first deadline
+processRecord** deadlineHeap = NULL;    // the jobs with deadlines, as a binary min-heap ordered by processRecord.deadline
+unsigned int deadlineCount = 0; // number of jobs in the heap
+unsigned int deadlineCap = 0;   // allocated size of the heap
 
-            // Here, we need to derive the job number and the pointer to the process record of the processed process (we know only PID)
-            processRecord* i = procs;   // Pointer to the process record; we initialize it with the first record in the table
-            unsigned int jobNum = 1;    // job number; we initialize it with the job number of the first job in the table
-            while (i != NULL && i->pid != proc) {   // If the PID in the current record is the same as the PID of the processed process,
-                                                    // we have found the appropriate process record; if the pointer to the current process record is NULL,
-                                                    // we have scanned the entire job table, and we couldn't find the relevant record
-                jobNum++;   // increase the job number counter
-                i = i->next;    // advance to the next record
-            }
-            if (i == NULL) {    // we haven't found the process in our job table
-                fprintf(stderr, "\nFATAL ERROR (UNKNOWN): waitpid() system call failed: returned PID is not a child. Terminating...\n");
-                exit(3);
-            }
-            i->exitCode = status;   // update the exit code in the record
-            // Update the execution status in the record
-            if (WIFEXITED(status)) i->status = done;
-            else if (WIFSIGNALED(status)) i->status = terminated;
-            else if (WCOREDUMP(status)) i->status = terminated;
-            else if (WIFSTOPPED(status)) i->status = stopped;
+// _swapDeadlines() - swaps two items of the deadline heap
+void _swapDeadlines(unsigned int a, unsigned int b) {
+    processRecord* p = deadlineHeap[a];
 
-            pushStatusBuffer(i, jobNum);    // Place in the queue for printing the update message
+    deadlineHeap[a] = deadlineHeap[b];
+    deadlineHeap[b] = p;
+    deadlineHeap[a]->deadlineSlot = a;
+    deadlineHeap[b]->deadlineSlot = b;
+}
 
-            // If the process was in the foreground, and now it is not running, we need to set the currentProc pointer to NULL
-            if (!i->background) {
-                if (currentProc != i) {
-                    fprintf(stderr, "\nFATAL ERROR (UNKNOWN): job table is corrupt\n");
-                    exit(4);
-                }
-                else if (i->status != running) {
-                    currentProc = NULL;
-                }
-            }
+// _siftDeadline() - moves the item of the deadline heap up or down until the heap is ordered again
+void _siftDeadline(unsigned int i) {
+    unsigned int child;
 
-            // Check the next process
-            proc = waitpid(WAIT_ANY, &status, WNOHANG | WUNTRACED);
-        }
+    while (i > 0 && deadlineHeap[i]->deadline < deadlineHeap[(i - 1) / 2]->deadline) {
+        _swapDeadlines(i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+    while ((child = 2 * i + 1) < deadlineCount) {
+        if (child + 1 < deadlineCount && deadlineHeap[child + 1]->deadline < deadlineHeap[child]->deadline) child++;
+        if (deadlineHeap[child]->deadline >= deadlineHeap[i]->deadline) break;
+        _swapDeadlines(i, child);
+        i = child;
+    }
+}
 
-        // No more processes left to process
+// _armDeadlineTimer() - arms the timerfd for the earliest deadline, or disarms it if there are no deadlines
+void _armDeadlineTimer() {
+    struct itimerspec its;
 
-        // If no process is in the foreground, just return...
-        if (currentProc == NULL) break;
-        // ...otherwise, busy wait
-        proc = waitpid(WAIT_ANY, &status, WUNTRACED);
+    memset(&its, 0, sizeof(its));
+    if (deadlineCount > 0) {
+        its.it_value.tv_sec = (time_t) deadlineHeap[0]->deadline;
+        its.it_value.tv_nsec = (long) ((deadlineHeap[0]->deadline - its.it_value.tv_sec) * 1e9);
+        if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0) its.it_value.tv_nsec = 1;    // (all zeros would disarm it)
     }
+    timerfd_settime(deadlineTimer, TFD_TIMER_ABSTIME, &its, NULL);
 }
 
 /*
- * newProcess() - creates a new process, places its record in the job table and launches it
- * 
+ * setDeadline() - sets the time when the next stage of the timeout of a job is due (see processRecord.timeoutStage)
  * Arguments:
- * command - path to the executable
- * args (array of strings) - command line arguments to be passed
- * background - background flag; non-zero if the process is to be executed in the background
+ * p - the job;
+ * when - the CLOCK_MONOTONIC time, in seconds.
+ *
+ * Returns 0 on success, and -1 if the timer cannot be created (the reason is printed).
  */
-void newProcess(char* command, char** args, int background) {
-    // Temporarily ignore all the incoming signals
-    signal(SIGINT, SIG_IGN);
-    signal(SIGQUIT, SIG_IGN);
-    signal(SIGTSTP, SIG_IGN);
-    signal(SIGTTIN, SIG_IGN);
-    signal(SIGTTOU, SIG_IGN);
-
-    // Allocate memory for the process record
-    processRecord* newP = (processRecord*) malloc(sizeof(processRecord));
-    if (!newP) {
-        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
-        exit(2);
+int setDeadline(processRecord* p, double when) {
+    if (deadlineTimer < 0 && (deadlineTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        printf("Unable to create the timer for the timeout: %s.\n", strerror(errno));
+        return -1;
     }
 
-    // Allocate memory for the copy of the path to executable that will be stored in the process record
-    newP->command = (char*) malloc(strlen(command) + 1);
-    if (!newP->command) {
-        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
-        exit(2);
+    if (p->deadlineSlot < 0) {  // A new item of the heap
+        if (deadlineCount == deadlineCap) {
+            deadlineCap = deadlineCap ? deadlineCap * 2 : 16;
+            deadlineHeap = (processRecord**) realloc(deadlineHeap, deadlineCap * sizeof(processRecord*));
+            if (!deadlineHeap) {
+                fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+                exit(2);
+            }
+        }
+        p->deadlineSlot = deadlineCount;
+        deadlineHeap[deadlineCount++] = p;
     }
+    p->deadline = when;
+    _siftDeadline(p->deadlineSlot);
+    _armDeadlineTimer();
+    return 0;
+}
 
-    // Populate the process record with all the relevant data
-    strcpy(newP->command, command);
-    newP->exitCode = 0;
-    newP->status = running;
-    newP->background = background;
+// clearDeadline() - removes the job from the deadline heap (if it is there)
+void clearDeadline(processRecord* p) {
+    unsigned int i = p->deadlineSlot;
+
+    if (p->deadlineSlot < 0) return;
+    p->deadlineSlot = -1;
+    deadlineCount--;
+    if (i < deadlineCount) {    // Move the last item into the hole
+        deadlineHeap[i] = deadlineHeap[deadlineCount];
+        deadlineHeap[i]->deadlineSlot = i;
+        _siftDeadline(i);
+    }
+    _armDeadlineTimer();
+}
 
-    // By default, we think that the job table is empty, so the 'prev' should point to the last record, i.e. to itself
-    newP->prev = newP;
-    // This record will be the last, so its 'next' will point to NULL
-    newP->next = NULL;
+/*
+ * expireDeadlines() - acts on all the deadlines that are due: sends SIGTERM to the jobs whose timeout expired (scheduling SIGKILL
+ * if they have --kill-after), and SIGKILL to the jobs which have survived SIGTERM for too long
+ * Called when the timerfd becomes readable. The jobs are not reaped here; updateStatus() reports them as usual.
+ */
+void expireDeadlines() {
+    uint64_t expirations;
+    double now = monotonicNow();
+    processRecord* p;
+
+    if (read(deadlineTimer, &expirations, sizeof(expirations)) < 0) { /* nothing to read: the deadlines are checked anyway */ }
+
+    while (deadlineCount > 0 && deadlineHeap[0]->deadline <= now) {
+        p = deadlineHeap[0];
+        clearDeadline(p);
+        if (p->timeoutStage == TIMEOUT_ARMED) {
+            killpg(p->pid, SIGTERM);
+            killpg(p->pid, SIGCONT);    // A stopped job would not get SIGTERM until it is resumed
+            p->timeoutStage = TIMEOUT_TERM;
+            if (p->killAfter > 0) setDeadline(p, now + p->killAfter);
+        }
+        else if (p->timeoutStage == TIMEOUT_TERM) {
+            killpg(p->pid, SIGKILL);
+            p->timeoutStage = TIMEOUT_KILL;
+        }
+    }
+}
 
-    if (procs != NULL) {    // If the job table is not empty
-        newP->prev = procs->prev;   // Update the 'prev' of the new record
-        procs->prev->next = newP;   // Update the 'next' of currently the last record
-        procs->prev = newP; // Update the 'prev' of the head, i.e. place the new record as the tail
+/*
+ * startTimeout() - sets (or, with a zero timeout, removes) the deadline of a job, as requested with the timeout options
+ * Returns 0 on success, and -1 if the deadline could not be set.
+ */
+int startTimeout(processRecord* p, timeoutOptions* t) {
+    if (t->timeout <= 0) {  // No deadline: if SIGTERM was already sent, only SIGKILL is cancelled
+        clearDeadline(p);
+        if (p->timeoutStage == TIMEOUT_ARMED) p->timeoutStage = TIMEOUT_NONE;
+        return 0;
     }
-    else {
-        procs = newP;   // The new record is the first and only record in the job table
+    if (setDeadline(p, monotonicNow() + t->timeout) != 0) return -1;
+    p->timeoutStage = TIMEOUT_ARMED;
+    p->killAfter = t->killAfter;
+    return 0;
+}
+
+// _printTimeoutInfo() - outputs the state of the deadline of a job in the form " timeout: SIGTERM in 12.5s (then SIGKILL after 5.0s)"
+void _printTimeoutInfo(processRecord* p) {
+    double left = p->deadline - monotonicNow();
+
+    if (left < 0) left = 0;
+    if (p->timeoutStage == TIMEOUT_ARMED) {
+        printf(" timeout: SIGTERM in %.1fs", left);
+        if (p->killAfter > 0) printf(" (then SIGKILL after %.1fs)", p->killAfter);
     }
+    else if (p->timeoutStage == TIMEOUT_TERM && p->deadlineSlot >= 0) printf(" timeout: expired, SIGTERM sent; SIGKILL in %.1fs", left);
+    else if (p->timeoutStage == TIMEOUT_TERM) printf(" timeout: expired, SIGTERM sent");
+    else if (p->timeoutStage == TIMEOUT_KILL) printf(" timeout: expired, SIGKILL sent");
+}
 
-    int jobNum = nextJobNum;    // The job number of the current record is size(job table) + 1
-    nextJobNum++;   // Increment the size of the job table
+/*
+ * ==== Job table export (seashell-top) ====
+ *
+ * The shell publishes its job table in the shared memory object "/seashell-top-PID" (see seashell-shm.h), so that monitoring tools
+ * like seashell-top can watch any number of shells without ptrace(), /proc scraping or even system calls: the table is protected
+ * with a sequence lock, and the readers just copy it. The table is rewritten whenever the job table changes (a job is launched,
+ * resumed, stops, finishes or leaves the table), and every EXPORT_INTERVAL seconds while some job is running, so that the CPU times
+ * stay fresh; the ticks come from a timerfd polled together with everything else (see pollWithCapture()).
+ * Only the main shell (interactive or running a script) publishes its table; the one-shot and the server modes don't.
+ */
 
-    pid_t childPid = fork();
+#define EXPORT_INTERVAL 1   // Interval between the updates of the CPU times, in seconds
 
-    if (childPid < 0) { // An error occured
-        if (errno == EAGAIN) fprintf(stderr, "Couldn't create the process: process limit exceeded.\n");
-        else if (errno == ENOMEM) fprintf(stderr, "Not enough memory to create the process.\n");
-        else {
-            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): fork() system call failed. Terminating...\n");
-            exit(3);
-        }
+seashellShmTable* exportTable = NULL;   // the published job table; NULL if the job table is not published
+char exportName[64];    // name of the shared memory object
+pid_t exportOwner = 0;  // PID of the shell which created the object: the children (which may call exit()) must not remove it
+int exportTimer = -1;   // the timerfd ticking while some job is running
+int exportTicking = 0;  // non-zero if the timerfd is armed
+
+// _nanoseconds() - converts a timespec/timeval pair of fields into nanoseconds
+uint64_t _nanoseconds(uint64_t seconds, uint64_t fraction, uint64_t perSecond) {
+    return seconds * 1000000000ull + fraction * (1000000000ull / perSecond);
+}
+
+// closeJobExport() - marks the published table as closed and removes the shared memory object; registered with atexit()
+void closeJobExport() {
+    if (exportTable == NULL || getpid() != exportOwner) return;
+    seashellShmBeginWrite(exportTable);
+    exportTable->closed = 1;
+    seashellShmEndWrite(exportTable);
+    munmap(exportTable, sizeof(seashellShmTable));
+    shm_unlink(exportName);
+    exportTable = NULL;
+}
+
+/*
+ * openJobExport() - creates the shared memory object for the job table and the timerfd for the updates of the CPU times
+ * If something fails, the job table is simply not published (the reason is printed to stderr).
+ */
+void openJobExport() {
+    int fd;
+
+    sprintf(exportName, SEASHELL_SHM_PREFIX "%d", getpid());
+    fd = shm_open(exportName, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+    if (fd < 0 && errno == EEXIST) {    // Left by a dead shell with the same PID
+        shm_unlink(exportName);
+        fd = shm_open(exportName, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
     }
-    else if (childPid == 0) {   // We're in the child process now
-        // Stop ignoring signals
-        signal(SIGINT, SIG_DFL);
-        signal(SIGQUIT, SIG_DFL);
-        signal(SIGTSTP, SIG_DFL);
-        signal(SIGTTIN, SIG_DFL);
-        signal(SIGTTOU, SIG_DFL);
+    if (fd < 0) {
+        fprintf(stderr, "Unable to publish the job table for seashell-top: %s.\n", strerror(errno));
+        return;
+    }
+    if (ftruncate(fd, sizeof(seashellShmTable)) != 0
+        || (exportTable = (seashellShmTable*) mmap(NULL, sizeof(seashellShmTable), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED
+        || (exportTimer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        fprintf(stderr, "Unable to publish the job table for seashell-top: %s.\n", strerror(errno));
+        if (exportTable != MAP_FAILED && exportTable != NULL) munmap(exportTable, sizeof(seashellShmTable));
+        exportTable = NULL;
+        if (exportTimer >= 0) close(exportTimer);
+        exportTimer = -1;
+        close(fd);
+        shm_unlink(exportName);
+        return;
+    }
+    close(fd);  // The mapping stays
+
+    // The object is zero-filled: the sequence number is even, and there are no jobs
+    exportTable->magic = SEASHELL_SHM_MAGIC;
+    exportTable->version = SEASHELL_SHM_VERSION;
+    exportTable->shellPid = getpid();
+    exportOwner = getpid();
+    atexit(closeJobExport);
+}
 
-        char* semname = (char*) malloc(33); // Name of the semaphore. It should be of the form '/seashell10_childPID'
-        if (!semname) {
-            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
-            exit(2);
+// exportJobs() - rewrites the published job table according to the current state of the job table
+void exportJobs() {
+    processRecord* p;
+    seashellShmJob* j;
+    struct timespec now, ts;
+    struct itimerspec its;
+    double age;
+    uint32_t n = 0, total = 0;
+    int anyRunning = 0;    // non-zero if some job is running
+    const int32_t statuses[] = { SEASHELL_SHM_RUNNING, SEASHELL_SHM_STOPPED, SEASHELL_SHM_DONE, SEASHELL_SHM_TERMINATED, SEASHELL_SHM_TIMEDOUT };
+
+    if (exportTable == NULL) return;
+    clock_gettime(CLOCK_REALTIME, &now);
+    age = monotonicNow();
+
+    seashellShmBeginWrite(exportTable);
+    for (p = procs; p != NULL; p = p->next, total++) {
+        if (p->status == running) anyRunning = 1;
+        if (n == SEASHELL_SHM_JOBS) continue;   // Doesn't fit; only counted
+        j = &exportTable->jobs[n++];
+        j->jobId = p->jobId;
+        j->pid = p->pid;
+        j->status = statuses[p->status];
+        j->exitCode = p->exitCode;
+        j->background = p->background;
+        j->startTime = _nanoseconds(now.tv_sec, now.tv_nsec, 1000000000) - (uint64_t) ((age - p->started) * 1e9);
+        if (p->status == running || p->status == stopped) { // The CPU clock of the process; the last value is kept if it is not available
+            if (clock_gettime(p->cpuClock, &ts) == 0) j->cpuTime = _nanoseconds(ts.tv_sec, ts.tv_nsec, 1000000000);
         }
+        else j->cpuTime = _nanoseconds(p->usage.ru_utime.tv_sec + p->usage.ru_stime.tv_sec,
+            p->usage.ru_utime.tv_usec + p->usage.ru_stime.tv_usec, 1000000);
+        strncpy(j->command, p->command, SEASHELL_SHM_COMMAND - 1);
+        j->command[SEASHELL_SHM_COMMAND - 1] = '\0';
+    }
+    exportTable->count = n;
+    exportTable->total = total;
+    exportTable->updated = _nanoseconds(now.tv_sec, now.tv_nsec, 1000000000);
+    seashellShmEndWrite(exportTable);
+
+    // Tick while some job is running
+    if (anyRunning != exportTicking) {
+        memset(&its, 0, sizeof(its));
+        if (anyRunning) its.it_value.tv_sec = its.it_interval.tv_sec = EXPORT_INTERVAL;
+        timerfd_settime(exportTimer, 0, &its, NULL);
+        exportTicking = anyRunning;
+    }
+}
 
-        if (sprintf(semname, "/seashell10_%d", getpid()) < 0) {
-            fprintf(stderr, "FATAL ERROR (UNKNOWN): Unable to create the name for the semaphore (child). Terminating...\n");
-            exit(3);
-        }
+// exportTick() - updates the CPU times in the published job table; called when the timerfd becomes readable
+void exportTick() {
+    uint64_t expirations;
 
-        // Open the semaphore
-        if ((mainBusy = sem_open(semname, O_CREAT, S_IRWXU, 0)) == SEM_FAILED) {
-            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to initiate a semaphore (child). Terminating...\n");
-            exit(3);
-        }
+    if (read(exportTimer, &expirations, sizeof(expirations)) < 0) { /* a spurious wakeup */ }
+    exportJobs();
+}
 
-        sem_wait(mainBusy); // Wait until the parent does all the preliminary tasks...
+/*
+ * ==== Output capture (the 'capture' and 'output' built-in commands) ====
+ *
+ * After 'capture on', the standard output and the standard error of every job started with '&' go to a pipe instead of the terminal.
+ * The shell drains the pipes whenever it would otherwise sleep - at the command prompt, while a foreground job runs, in 'wait' -
+ * into a ring buffer of the job holding the last CAPTURE_RING_SIZE bytes, so a chatty job neither garbles the prompt nor runs at the
+ * speed of the terminal. With 'capture on --log', everything is also appended to a log file mapped into memory, so nothing is dropped.
+ * 'output N' shows the captured output; 'fg N' replays it, and while the job is in the foreground, its output goes to the terminal.
+ * A finished job whose output has not been shown stays in the job table until it is.
+ */
 
-        if (sem_close(mainBusy) != 0) { // ...then close the semaphore...
-            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to close the semaphore (child). Terminating...\n");
-            exit(3);
-        }
-        free(semname);
+int captureOn = 0;  // non-zero if the output of the new background jobs is captured
+int captureLog = 0; // non-zero if the captured output is also written to log files
+unsigned int captureLogCount = 0;   // number of log files created so far; makes their names unique
+int childSignalPipe[2] = {-1, -1};  // self-pipe: the SIGCHLD handler writes a byte into it, so that poll() can wait for children too
+volatile sig_atomic_t waitWasInterrupted = 0;   // set by waitInterrupted() (Ctrl-C while waiting)
 
-        // ...and execute the command.
-        execv(command, args);
-        _exit(-1);  // If execv() failed, exit immediately
+// childChanged() - SIGCHLD handler installed while output is captured or deadlines are set; wakes up pollWithCapture() through the self-pipe
+void childChanged(int sig) {
+    int savedErrno = errno;
+
+    (void) sig;
+    if (write(childSignalPipe[1], "", 1) < 0) { /* the pipe is full, so a wakeup is pending anyway */ }
+    errno = savedErrno;
+}
+
+/*
+ * watchChildren() - sets up the self-pipe and the SIGCHLD handler (once), so that waitForChild() can be used
+ * Called before the first job whose output is captured or which has a deadline is launched/resumed.
+ * Returns 0 on success, and -1 if the pipe cannot be created.
+ */
+int watchChildren() {
+    struct sigaction sa;
+
+    if (childSignalPipe[0] >= 0) return 0;
+    if (pipe2(childSignalPipe, O_NONBLOCK | O_CLOEXEC) != 0) return -1;
+    sa.sa_handler = childChanged;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;   // getline(), wait4() etc. are simply restarted
+    sigaction(SIGCHLD, &sa, NULL);
+    return 0;
+}
+
+/*
+ * openCapture() - prepares the capture of the output of a new job: creates the pipe, the ring buffer and (if requested) the log file
+ * Returns the write end of the pipe, which is to become the standard output and the standard error of the job; -1 on failure
+ * (then the output is not captured).
+ */
+int openCapture(processRecord* p) {
+    int fds[2];
+    outputRing* o;
+    const char* dir;
+    char* path;
+
+    if (watchChildren() != 0) return -1;
+    if (pipe2(fds, O_CLOEXEC) != 0) return -1;
+    fcntl(fds[0], F_SETFL, O_NONBLOCK); // The shell only reads what is there
+
+    o = (outputRing*) malloc(sizeof(outputRing));
+    if (!o) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
     }
-    else if (childPid > 0) {    // We're in the parent process
-        char* semname = (char*) malloc(33); // Name of the semaphore. It should be of the form '/seashell10_childPID'
-        if (!semname) {
+    o->total = 0;
+    o->shown = 0;
+    o->logFd = -1;
+    o->logPath = NULL;
+    o->log = NULL;
+    o->logCap = 0;
+
+    if (captureLog) {
+        dir = getenv("TMPDIR");
+        if (dir == NULL || *dir == '\0') dir = "/tmp";
+        path = (char*) malloc(strlen(dir) + 64);
+        if (!path) {
             fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
             exit(2);
         }
-
-        if (sprintf(semname, "/seashell10_%d", childPid) < 0) {
-            fprintf(stderr, "FATAL ERROR (UNKNOWN): Unable to create the name for the semaphore (parent). Terminating...\n");
-            exit(3);
+        sprintf(path, "%s/seashell-%d-%u.log", dir, getpid(), ++captureLogCount);
+        o->logFd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, S_IRUSR | S_IWUSR);
+        if (o->logFd < 0) {
+            printf("Unable to create the log file [%s]: %s; only the last %d bytes will be kept.\n", path, strerror(errno), CAPTURE_RING_SIZE);
+            free(path);
         }
+        else o->logPath = path;
+    }
 
-        // Open the semaphore
-        if ((mainBusy = sem_open(semname, O_CREAT, S_IRWXU, 0)) == SEM_FAILED) {
-            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to initiate a semaphore (parent). Terminating...\n");
-            exit(3);
+    p->output = o;
+    p->outFd = fds[0];
+    return fds[1];
+}
+
+// storeOutput() - appends a piece of the captured output to the ring buffer and the log
+void storeOutput(outputRing* o, const char* buf, size_t len) {
+    size_t pos, part, skip = 0;
+
+    if (o->logFd >= 0) {
+        if (o->total + len > o->logCap) {   // Grow the log file and its mapping
+            size_t cap = o->logCap;
+            char* map;
+            while (o->total + len > cap) cap += CAPTURE_LOG_STEP;
+            if (ftruncate(o->logFd, cap) != 0
+                    || (map = (char*) (o->log ? mremap(o->log, o->logCap, cap, MREMAP_MAYMOVE)
+                                              : mmap(NULL, cap, PROT_READ | PROT_WRITE, MAP_SHARED, o->logFd, 0))) == MAP_FAILED) {
+                printf("Unable to extend the log file [%s]: %s; only the last %d bytes will be kept from now on.\n",
+                    o->logPath, strerror(errno), CAPTURE_RING_SIZE);
+                if (o->log) munmap(o->log, o->logCap);
+                if (ftruncate(o->logFd, o->total) != 0) { /* the log just keeps its size */ }
+                close(o->logFd);
+                o->logFd = -1;
+                o->log = NULL;
+                o->logCap = 0;
+            }
+            else {
+                o->log = map;
+                o->logCap = cap;
+            }
         }
+        if (o->log) memcpy(o->log + o->total, buf, len);
+    }
 
-        newP->pid = childPid;   // Update the PID stored in the record
-        _printProcInfo(newP, jobNum, background, running, 0);   // Print the status update: the process is running
+    // Only the last CAPTURE_RING_SIZE bytes matter for the ring
+    if (len > CAPTURE_RING_SIZE) skip = len - CAPTURE_RING_SIZE;
+    pos = (o->total + skip) % CAPTURE_RING_SIZE;
+    part = len - skip;
+    if (part > CAPTURE_RING_SIZE - pos) part = CAPTURE_RING_SIZE - pos;
+    memcpy(o->data + pos, buf + skip, part);
+    memcpy(o->data, buf + skip + part, len - skip - part);
+    o->total += len;
+}
 
-        if (setpgid (childPid, childPid) < 0) { // Place the child process in its own process group
-            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to set the PGID for the child. Terminating...\n");
-            exit(3);
+// firstKept() - position of the first captured byte which is still available (in the log or in the ring buffer)
+size_t firstKept(outputRing* o) {
+    if (o->log || o->total <= CAPTURE_RING_SIZE) return 0;
+    return o->total - CAPTURE_RING_SIZE;
+}
+
+// keptByte() - the captured byte at the given position (which must be available)
+char keptByte(outputRing* o, size_t pos) {
+    return o->log ? o->log[pos] : o->data[pos % CAPTURE_RING_SIZE];
+}
+
+// writeOutput() - writes the captured bytes from the given position until the end to the standard output, and marks them as shown
+void writeOutput(outputRing* o, size_t from) {
+    size_t to = o->total, part;
+
+    fflush(stdout);
+    if (from < firstKept(o)) {
+        printf("(%zu bytes of output were dropped)\n", firstKept(o) - from);
+        fflush(stdout);
+        from = firstKept(o);
+    }
+    while (from < to) {
+        if (o->log) part = to - from;
+        else {
+            part = CAPTURE_RING_SIZE - from % CAPTURE_RING_SIZE;
+            if (part > to - from) part = to - from;
         }
+        if (fwrite(o->log ? o->log + from : o->data + from % CAPTURE_RING_SIZE, 1, part, stdout) != part) break;
+        from += part;
+    }
+    fflush(stdout);
+    o->shown = to;
+}
 
-        if (!background) {  // If the process is to be executed in the foreground...
-            if (tcsetpgrp(STDIN_FILENO, childPid) < 0) {    // ...hand the control over the terminal to the child process
-                fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to set the terminal foreground PGID. Terminating...\n");
-                exit(3);
-            }
+/*
+ * drainCapture() - reads all the output of a job which is available in its pipe
+ * The output of the foreground job goes directly to the terminal (it is stored as well). At the end of the output, the pipe is closed.
+ */
+void drainCapture(processRecord* p) {
+    char buf[16384];
+    ssize_t len;
+
+    while (p->outFd >= 0) {
+        len = read(p->outFd, buf, sizeof(buf));
+        if (len > 0) {
+            storeOutput(p->output, buf, len);
+            if (p == currentProc) writeOutput(p->output, p->output->shown);
         }
+        else if (len < 0 && (errno == EAGAIN || errno == EINTR)) break;
+        else {  // End of the output (or an error)
+            close(p->outFd);
+            p->outFd = -1;
+        }
+    }
+}
 
-        sem_post(mainBusy); // Let the child process know that it may execute the command
+/*
+ * pollWithCapture() - the same as poll() without a timeout, but the captured output of the jobs is drained, and the deadlines
+ * of the jobs are enforced (see expireDeadlines()) while waiting
+ * Returns the number of the given file descriptors which are ready, or -1 on error. Unless it was Ctrl-C in the 'wait'/'output'
+ * built-in commands (see waitWasInterrupted), a signal doesn't interrupt the waiting. If no file descriptors are given (n == 0),
+ * returns as soon as some output has been captured (or some deadline has expired).
+ */
+int pollWithCapture(struct pollfd* fds, unsigned int n) {
+    struct pollfd* all;
+    processRecord** jobs;
+    processRecord* p;
+    unsigned int count = n, i;
+    int ready = 0;
+
+    for (p = procs; p != NULL; p = p->next) if (p->outFd >= 0) count++;
+    if (deadlineCount > 0) count++; // the timerfds go last
+    if (exportTicking) count++;
+    if (count == n) {   // Nothing is captured, there are no deadlines, and the job table export doesn't tick
+        while ((ready = poll(fds, n, -1)) < 0 && errno == EINTR && !waitWasInterrupted);   // (SIGCHLD of other children, etc.)
+        return ready;
+    }
 
-        if (sem_close(mainBusy) != 0) { // Close the semaphore
-            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to close the semaphore (parent). Terminating...\n");
-            exit(3);
-        }
-        free(semname);
+    all = (struct pollfd*) malloc(count * sizeof(struct pollfd));
+    jobs = (processRecord**) malloc(count * sizeof(processRecord*));
+    if (!all || !jobs) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+    memcpy(all, fds, n * sizeof(struct pollfd));
+    for (i = n, p = procs; p != NULL; p = p->next) {
+        if (p->outFd < 0) continue;
+        all[i].fd = p->outFd;
+        all[i].events = POLLIN;
+        jobs[i++] = p;
+    }
+    if (deadlineCount > 0) {
+        all[i].fd = deadlineTimer;
+        all[i].events = POLLIN;
+        jobs[i++] = NULL;
+    }
+    if (exportTicking) {
+        all[i].fd = exportTimer;
+        all[i].events = POLLIN;
+        jobs[i] = NULL;
+    }
 
-        if (!background) {  // If the process is to be executed in the foreground...
-            currentProc = newP; // Update currentProc correspondingly
-            updateStatus(); // busy wait
-            // After the process stopped/terminated, we need to return the control over the terminal to the shell
-            if (tcsetpgrp(STDIN_FILENO, getpid()) < 0) {
-                fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to set the terminal foreground PGID. Terminating...\n");
-                exit(3);
+    do {
+        if (poll(all, count, -1) < 0) {
+            if (errno == EINTR && !waitWasInterrupted) continue;
+            ready = -1;
+            break;
+        }
+        for (i = n; i < count; i++) {
+            if (all[i].revents && jobs[i] == NULL && all[i].fd == deadlineTimer) expireDeadlines();
+            else if (all[i].revents && jobs[i] == NULL) exportTick();
+            else if (all[i].revents) {
+                drainCapture(jobs[i]);
+                if (jobs[i]->outFd < 0) all[i].fd = -1; // poll() ignores negative file descriptors
             }
         }
-    }
+        for (i = 0; i < n; i++) {
+            fds[i].revents = all[i].revents;
+            if (fds[i].revents) ready++;
+        }
+    } while (ready == 0 && n > 0);  // Without any file descriptors given, any captured output (or timer) is enough
 
-    // Stop ignoring signals
-    signal(SIGINT, SIG_DFL);
-    signal(SIGQUIT, SIG_DFL);
-    signal(SIGTSTP, SIG_DFL);
-    signal(SIGTTIN, SIG_DFL);
-    signal(SIGTTOU, SIG_DFL);
+    free(all);
+    free(jobs);
+    return ready;
+}
+
+// isCapturing() - returns non-zero if the output of some job is still being captured
+int isCapturing() {
+    processRecord* p;
+
+    for (p = procs; p != NULL; p = p->next) if (p->outFd >= 0) return 1;
+    return 0;
+}
+
+// mustPoll() - returns non-zero if the shell has to wait with pollWithCapture(): some output is captured, some deadline is set,
+// or the job table export is ticking
+int mustPoll() {
+    return isCapturing() || deadlineCount > 0 || exportTicking;
+}
+
+// waitForChild() - sleeps until some child changes its state, draining the captured output meanwhile (see updateStatus())
+void waitForChild() {
+    struct pollfd pfd;
+    char buf[64];
+
+    pfd.fd = childSignalPipe[0];
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    waitWasInterrupted = 0;
+    pollWithCapture(&pfd, 1);
+    while (read(childSignalPipe[0], buf, sizeof(buf)) > 0);
 }
 
 /*
- * resumeProcess() - resumes a stopped process in the background/foreground, or brings a
- * currently running background process to the foreground
- * Called by the 'bg' and 'fg' built-in commands.
- * 
+ * showOutput() - prints the captured output of a job
  * Arguments:
- * jN - job number of the targeted process;
- * backgr - background flag.
+ * p - the job;
+ * tail - if non-zero, only this many last lines are printed.
  */
-void resumeProcess(unsigned int jN, int backgr) {
-    // Temporarily ignore signals
-    signal(SIGINT, SIG_IGN);
-    signal(SIGQUIT, SIG_IGN);
-    signal(SIGTSTP, SIG_IGN);
-    signal(SIGTTIN, SIG_IGN);
-    signal(SIGTTOU, SIG_IGN);
-
-    // Find the relevant job record
-    processRecord* p = procs;
-    unsigned int i;
-    for (i = 1; i < jN; i++) p = p->next;
+void showOutput(processRecord* p, unsigned long tail) {
+    outputRing* o = p->output;
+    size_t from, pos;
 
-    if (p->background == backgr && p->status == running) {
-        printf("Nothing to do.\n");
+    drainCapture(p);    // Take whatever is already in the pipe
+    if (tail == 0) {
+        writeOutput(o, 0);  // (tells how much was dropped, if anything)
         return;
     }
-    
-    if (p->status == running) printf("Attempt to bring to ");
-    else printf("Attempt to resume in ");
 
-    if (backgr) printf("background: ");
-    else printf("foreground: ");
+    // Go back 'tail' line breaks (the final line break doesn't count)
+    from = firstKept(o);
+    pos = o->total;
+    if (pos > from && keptByte(o, pos - 1) == '\n') pos--;
+    while (pos > from && (keptByte(o, pos - 1) != '\n' || --tail > 0)) pos--;
+    writeOutput(o, pos);
+}
 
-    p->background = backgr;
+// closeCapture() - stops capturing the output of a job and frees the ring buffer; the log file is removed
+void closeCapture(processRecord* p) {
+    outputRing* o = p->output;
+
+    if (p->outFd >= 0) close(p->outFd);
+    p->outFd = -1;
+    if (o == NULL) return;
+    if (o->log) munmap(o->log, o->logCap);
+    if (o->logFd >= 0) close(o->logFd);
+    if (o->logPath) {
+        unlink(o->logPath);
+        free(o->logPath);
+    }
+    free(o);
+    p->output = NULL;
+}
 
-    _printProcInfo(p, jN, backgr, running, 0);
+// hasUnshownOutput() - returns non-zero if the job has captured output which has not been shown yet
+int hasUnshownOutput(processRecord* p) {
+    if (p->output == NULL) return 0;
+    drainCapture(p);
+    return p->output->total > p->output->shown;
+}
 
-    if (p->status != running) {  // If the process is stopped, we need to resume it by sending SIGCONT to it
-        if (kill(p->pid, SIGCONT) != 0) {
-            fprintf(stderr, "Unable to resume process: kill() system call failed.\n");
-            return;
-        } else p->status = running;
+/* removeProcess() - removes a process from the job table and frees all the resources used for maintaining it
+ * Called by flushStatusBuffer() for the processes that have been marked as 'terminated' or 'done'.
+ */
+void removeProcess(processRecord* p) {
+    // a) Connect the neighbors of the processed job between each other, so that they don't remember the processed job.
+    //    i.e., we remove the process record from the job table.
+    if (p->next != NULL) {  // If the item is not the last in the queue...
+        p->next->prev = p->prev;    // ...update the 'prev' pointer of the next item...
+    } else procs->prev = p->prev;   // ...otherwise, update the 'prev' pointer of the head
+    if (p == procs) {   // If the current item is being pointed to by the head, we need to update the head
+        procs = procs->next;
+    } else p->prev->next = p->next; // If it is not in the head, update the 'next' pointer of the previous item
+                                    // (if it is in the head, the 'next' pointer of the item pointed to by 'prev'
+                                    // should always stay NULL, since it is the last item)
+
+    // b) We unlink the named semaphore that was used at the time of creating the process
+    char* semname = (char*) malloc(33); // Name of the semaphore. It should be of the form '/seashell10_childPID'
+    if (!semname) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+    if (sprintf(semname, "/seashell10_%d", p->pid) < 0) {
+        fprintf(stderr, "FATAL ERROR (UNKNOWN): Unable to create the name for the semaphore while deleting a process. Terminating...\n");
+        exit(3);
     }
 
-    if (!backgr) {  // If the process is to be executed in the foreground...
-        if (tcsetpgrp(STDIN_FILENO, p->pid) < 0) {  // Hand the control over the terminal to the process
-            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to set the terminal foreground PGID. Terminating...\n");
-            exit(3);
-        }
-        currentProc = p;    // Update currentProc
-        updateStatus(); // busy wait
-        if (tcsetpgrp(STDIN_FILENO, getpid()) < 0) {    // Return the control over the terminal to the shell
-            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to set the terminal foreground PGID. Terminating...\n");
-            exit(3);
-        }
+    if (sem_unlink(semname) != 0) {
+        fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to unlink the semaphore. Terminating...\n");
+        exit(3);
     }
 
-    // Stop ignoring signals
-    signal(SIGINT, SIG_DFL);
-    signal(SIGQUIT, SIG_DFL);
-    signal(SIGTSTP, SIG_DFL);
-    signal(SIGTTIN, SIG_DFL);
-    signal(SIGTTOU, SIG_DFL);
+    // c) We free all the resources used for maintaining the process, and finally delete the record and decrease the job table size
+    free(semname);
+    freeSchedOptions(&p->sched);
+    if (p->pidfd >= 0) close(p->pidfd);
+    closePerfCounters(p);
+    closeCapture(p);
+    clearDeadline(p);
+    free(p->command);
+    free(p);
+    nextJobNum--;
+    exportJobs();
 }
 
-// getdir() - returns the string containing the current working directory
-char* getdir() {
-    unsigned long size = 0; // Current size of the buffer
-    char* status;   // Status of the execution of getcwd()
-    char* buffer = NULL;
+/* flushStatusBuffer() - obtains all the records from the status updates buffer and prints respective diagnostic messages based on them
+ * (one line per job; if several updates of the job were coalesced, their number is shown at the end of the line).
+ * Then, cleans all the resources for processes that have been marked as 'terminated' or 'done', and removes those processes from the job table.
+ * Finally, empties the status updates buffer. If some updates were dropped because the buffer was full, the current status of the
+ * affected jobs is printed instead.
+ */
+void flushStatusBuffer() {
+    statusUpdateItem item;  // copy of the currently processed item
+    processRecord* p;
+    processRecord* next;
+    unsigned int jobNum;
+    int finished;   // non-zero if the job is terminated/done
+    int keep;   // non-zero if the finished job stays in the job table
+
+    while (statusBufferHead != statusBufferTail) {  // until the buffer is completely empty
+        atomic_signal_fence(memory_order_acquire);  // The item is read only after the tail which published it
+        // First, take the item out of the buffer: after this, the producer will create a new item for the job instead of updating this one
+        statusBuffer[statusBufferHead % STATUS_RING_SIZE].proc->statusSlot = STATUS_SLOT_NONE;
+        item = statusBuffer[statusBufferHead % STATUS_RING_SIZE];
+        atomic_signal_fence(memory_order_release);  // The item is copied before its slot is given back to the producer
+        statusBufferHead++;
+
+        // Then, print the process info...
+        finished = item.proc->status == done || item.proc->status == terminated || item.proc->status == timedout;
+        keep = finished && hasUnshownOutput(item.proc); // A finished job stays in the job table until its captured output is shown
+        _printProcLine(item.proc, item.jobNum, item.backgr, item.s, item.exitCode);
+        if (item.updates > 1) printf("\t(%u status updates)", item.updates);
+        if (keep) printf("\t(see \"output %u\")", item.jobNum);
+        printf("\n");
+
+        // Finally, if the job is terminated/done, report its resource usage (if it was timed) and remove it from the job table
+        if (finished) {
+            if (item.proc->timed) reportJobTime(item.proc);
+            if (!keep) removeProcess(item.proc);
+        }
+    }
 
-    do {
-        size += 256;    // Increase the size of the buffer
-        buffer = (char*) malloc(size);  // Allocate memory for the buffer
-        if (!buffer) {
-           fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
-           exit(2);
+    if (statusOverflow > 0) {   // Some updates were dropped: report the current status of the affected jobs
+        printf("The status updates buffer was full: %u status updates were not recorded.\n", statusOverflow);
+        statusOverflow = 0;
+
+        p = procs;
+        for (jobNum = 1; p != NULL; jobNum++) {
+            next = p->next;
+            if (p->statusSlot == STATUS_SLOT_DROPPED) {
+                p->statusSlot = STATUS_SLOT_NONE;
+                finished = p->status == done || p->status == terminated || p->status == timedout;
+                keep = finished && hasUnshownOutput(p);
+                _printProcLine(p, jobNum, p->background, p->status, p->exitCode);
+                if (keep) printf("\t(see \"output %u\")", jobNum);
+                printf("\n");
+                if (finished) {
+                    if (p->timed) reportJobTime(p);
+                    if (!keep) removeProcess(p);
+                }
+            }
+            p = next;
         }
+    }
+}
 
-        status = getcwd(buffer, size);  // Try to get the working directory by calling getcwd()
-        if (status < 0 && errno != ERANGE) {    // Something unexpected & bad happened
-            free(buffer);
-            fprintf(stderr, "FATAL ERROR (UNKNOWN): getcwd() system call failed. Terminating...\n");
-            exit(3);
-            return NULL;
+/* pushStatusBuffer() - places a status update for the process into the status updates buffer; called by updateStatus().
+ * Arguments:
+ * p - process record;
+ * jobN - job number.
+ *
+ * The update item is created mainly based on the information currently contained in the p. If the process already has an item in the buffer,
+ * that item is updated instead. If the buffer is full, the update is dropped and counted; the job is marked, so that flushStatusBuffer() still reports it.
+ * Doesn't allocate memory and doesn't block; it must not interrupt flushStatusBuffer(), though (see the comment on the ring).
+ */
+void pushStatusBuffer(processRecord* p, unsigned int jobN) {
+    statusUpdateItem* newI;
+
+    if (p->statusSlot >= 0) {   // The job already has a pending update: coalesce
+        newI = &statusBuffer[p->statusSlot];
+        newI->updates++;
+    }
+    else if (p->statusSlot == STATUS_SLOT_DROPPED || statusBufferTail - statusBufferHead >= STATUS_RING_SIZE) { // The buffer is full
+        statusOverflow++;
+        p->statusSlot = STATUS_SLOT_DROPPED;
+        return;
+    }
+    else {  // Take the next free item of the ring
+        newI = &statusBuffer[statusBufferTail % STATUS_RING_SIZE];
+        newI->updates = 1;
+    }
+
+    // Fill the status update item with the relevant information...
+    newI->proc = p;
+    newI->jobNum = jobN;
+    newI->exitCode = p->exitCode;
+    newI->backgr = p->background;
+    newI->s = p->status;
+
+    // ...and, if it is a new item, publish it: the consumer sees it only after it has been completely filled
+    if (p->statusSlot < 0) {
+        p->statusSlot = statusBufferTail % STATUS_RING_SIZE;
+        atomic_signal_fence(memory_order_release);
+        statusBufferTail++;
+    }
+}
+
+/*
+ * updateStatus() - detects any changes in the execution status of the children and updates the job table correspondingly.
+ * Also, implements a busy wait in a case a process is running in the foreground.
+ * Called in several places of this code in cases when the children need to be watched and/or all the
+ * recent changes in the children's statuses need to be detected and/or we need to wait until a foreground process stops/terminates.
+ */
+void updateStatus() {
+    int status; // auxiliary variable used for storing the process' exit code as detected by wait4()
+    struct rusage usage;    // resource usage of the process, as reported by wait4()
+    int changed = 0;    // non-zero if the job table has changed (and is to be published again)
+    pid_t proc = wait4(WAIT_ANY, &status, WNOHANG | WUNTRACED, &usage);   // See if any child processes have stopped/terminated recently
+
+    while (1) {
+        while (proc != 0) { // The loop breaks when there are processes to wait for, but none of them has stopped/terminated
+            if (proc < 0) { // Some error has occurred...
+                if (errno == ECHILD) break; // Not a real error; we just don't have any processes to wait for; in this case, updateStatus() will just return
+                // Otherwise, we don't know what happened, but it was something bad
+                fprintf(stderr, "\nFATAL ERROR (UNKNOWN): wait4() system call failed. Terminating...\n");
+                exit(3);
+            }
+
+            // Here, we need to derive the job number and the pointer to the process record of the processed process (we know only PID)
+            processRecord* i = procs;   // Pointer to the process record; we initialize it with the first record in the table
+            unsigned int jobNum = 1;    // job number; we initialize it with the job number of the first job in the table
+            while (i != NULL && i->pid != proc) {   // If the PID in the current record is the same as the PID of the processed process,
+                                                    // we have found the appropriate process record; if the pointer to the current process record is NULL,
+                                                    // we have scanned the entire job table, and we couldn't find the relevant record
+                jobNum++;   // increase the job number counter
+                i = i->next;    // advance to the next record
+            }
+            if (i == NULL) {    // we haven't found the process in our job table
+                fprintf(stderr, "\nFATAL ERROR (UNKNOWN): wait4() system call failed: returned PID is not a child. Terminating...\n");
+                exit(3);
+            }
+            i->exitCode = status;   // update the exit code in the record
+            // Update the execution status in the record
+            if (WIFEXITED(status)) i->status = done;
+            else if (WIFSIGNALED(status)) i->status = terminated;
+            else if (WCOREDUMP(status)) i->status = terminated;
+            else if (WIFSTOPPED(status)) i->status = stopped;
+            if (i->status == done || i->status == terminated) {
+                i->usage = usage;   // The resource usage is final only when the process is gone
+                clearDeadline(i);
+                if (i->timeoutStage >= TIMEOUT_TERM) i->status = timedout;  // However it ended, it was because of the deadline
+                else i->limitHit = limitHitBy(i);
+            }
+
+            pushStatusBuffer(i, jobNum);    // Place in the queue for printing the update message
+            changed = 1;
+
+            // If the process was in the foreground, and now it is not running, we need to set the currentProc pointer to NULL
+            if (!i->background) {
+                if (currentProc != i) {
+                    fprintf(stderr, "\nFATAL ERROR (UNKNOWN): job table is corrupt\n");
+                    exit(4);
+                }
+                else if (i->status != running) {
+                    currentProc = NULL;
+                }
+            }
+
+            // Check the next process
+            proc = wait4(WAIT_ANY, &status, WNOHANG | WUNTRACED, &usage);
         }
 
-        if (status >= 0) break; // Hurray, we obtained the working directory successfully
+        // No more processes left to process
+        if (changed) exportJobs();  // Publish the changes (see seashell-top)
+        changed = 0;
 
-        free(buffer);
-    } while (1);    // If we got an error (status < 0), and it is ERANGE, it just means that the size of the buffer wasn't enough,
-                    // so we can increase it and try again
-    return buffer;
+        // If no process is in the foreground, just return...
+        if (currentProc == NULL) break;
+        // ...otherwise, busy wait; if needed, the pipes are drained, the deadlines are enforced etc. meanwhile (see pollWithCapture())
+        if (mustPoll()) {
+            waitForChild();
+            proc = wait4(WAIT_ANY, &status, WNOHANG | WUNTRACED, &usage);
+        }
+        else proc = wait4(WAIT_ANY, &status, WUNTRACED, &usage);
+    }
 }
 
 /*
- * strsplit() - splits the string str into parts, using the chars in the delims string as delimiters
- * Different parts of the string are considered to be separated by characters contained in delims, in any numbers or order.
- * Any part of the string enclosed in double quotes ("some part") will never be separated, even if it contains delimiters. In such
- * case, the double quotes will be removed from the result.
- * All the characters, including delimiters and double quotes, can be escaped using '\'. In this case, they will be treated "as is", i.e.
- * a delimiter character will not separate different parts of a string, and a double quote will not be seen as a double quote.
- * A '\' can also be escaped (i.e. '\\' is '\').
+ * signalProcess() - sends a signal to a process from the job table
+ * The signal is sent through the pidfd of the process, so that it can never reach an unrelated process which happens
+ * to have reused the PID; kill() is used only if the kernel doesn't support pidfds.
+ * Returns 0 on success, -1 on failure (see errno).
+ */
+int signalProcess(processRecord* p, int sig) {
+    if (p->pidfd >= 0) return (int) syscall(SYS_pidfd_send_signal, p->pidfd, sig, NULL, 0);
+    return kill(p->pid, sig);
+}
+
+/*
+ * newProcess() - creates a new process, places its record in the job table and launches it
  * 
- * The last item in the resulting array will always be the NULL pointer
+ * Arguments:
+ * command - path to the executable
+ * args (array of strings) - command line arguments to be passed
+ * background - background flag; non-zero if the process is to be executed in the background
+ * opts - the settings to be applied to the process (see launchOptions); NULL if there are none
  */
-char** strsplit(char* str, const char* delims) {
-    if (strpbrk(delims, "\"\\") != NULL) {  // Double quotes and the backslash cannot be delimiters
-       fprintf(stderr, "FATAL ERROR [strsplit()]: An illegal character used as a delimiter. You cannot use \" and \\ as delimiters. Terminating...\n");
-       exit(5);
+void newProcess(char* command, char** args, int background, launchOptions* opts) {
+    // Temporarily ignore all the incoming signals
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    // Allocate memory for the process record
+    processRecord* newP = (processRecord*) malloc(sizeof(processRecord));
+    int c;  // counter
+    if (!newP) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
     }
 
-    unsigned int bufsize = 16, pos = 0; // bufsize - size of the array of strings to be returned, pos - current position in this array of strings
-    char** parts = (char**) malloc(bufsize * sizeof(char*));    // Allocate memory for the array of strings,
-                                                                // i.e. array of pointers to char. To make the program more efficient,
-                                                                // we will not copy each part of the initial string into the new memory block,
-                                                                // but instead we will just alter the str string itself, insert '\0' chars where necessary,
-                                                                // and fill the 'parts' array with pointers to relevant chars in the middle of 'str'
-    char* temp; // Auxiliary variable to store the string to be added to 'parts'
-    char* curchar = str;    // Currently processed character
-    unsigned int shift; // We will need this when we delete some characters (e.g. '\' and '"') from the initial string
-    int doublequotes = 0;   // it is non-zero if double quotes were opened but not closed yet
+    // Allocate memory for the copy of the path to executable that will be stored in the process record
+    newP->command = (char*) malloc(strlen(command) + 1);
+    if (!newP->command) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
 
-    if (!parts) {
-       fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
-       exit(2);
+    // Populate the process record with all the relevant data
+    strcpy(newP->command, command);
+    newP->exitCode = 0;
+    newP->pidfd = -1;
+    newP->statusSlot = STATUS_SLOT_NONE;
+    newP->outFd = -1;
+    newP->output = NULL;
+    newP->jobId = ++lastJobId;
+    newP->timeoutStage = TIMEOUT_NONE;
+    newP->deadline = 0;
+    newP->killAfter = 0;
+    newP->deadlineSlot = -1;
+    newP->timed = TIME_NONE;
+    for (c = 0; c < PERF_COUNTERS; c++) newP->perfFds[c] = -1;
+    if (opts != NULL && opts->timed) { // The job takes over the timing
+        newP->timed = opts->timed;
+        opts->timed = TIME_NONE;
+    }
+    newP->started = monotonicNow();
+    newP->status = running;
+    newP->background = background;
+
+    // Scheduling settings: the ones requested explicitly, and then the background policy for the settings that were not requested
+    initSchedOptions(&newP->sched);
+    if (opts != NULL) mergeSchedOptions(&newP->sched, &opts->sched);
+    if (background && bgPolicyOn) mergeSchedOptions(&newP->sched, &bgPolicy);
+
+    // Resource limits: the ones requested explicitly, and then the ones set with 'ulimit'
+    initLimitOptions(&newP->limits);
+    if (opts != NULL) mergeLimitOptions(&newP->limits, &opts->limits);
+    mergeLimitOptions(&newP->limits, &jobLimits);
+    newP->limitHit = LIMIT_NONE;
+
+    // By default, we think that the job table is empty, so the 'prev' should point to the last record, i.e. to itself
+    newP->prev = newP;
+    // This record will be the last, so its 'next' will point to NULL
+    newP->next = NULL;
+
+    if (procs != NULL) {    // If the job table is not empty
+        newP->prev = procs->prev;   // Update the 'prev' of the new record
+        procs->prev->next = newP;   // Update the 'next' of currently the last record
+        procs->prev = newP; // Update the 'prev' of the head, i.e. place the new record as the tail
+    }
+    else {
+        procs = newP;   // The new record is the first and only record in the job table
+    }
+
+    int jobNum = nextJobNum;    // The job number of the current record is size(job table) + 1
+    nextJobNum++;   // Increment the size of the job table
+
+    int outWrite = -1;  // write end of the capture pipe, if the output of the job is captured
+    if (background && captureOn) outWrite = openCapture(newP);
+
+    pid_t childPid = fork();
+
+    if (childPid < 0) { // An error occured
+        if (outWrite >= 0) close(outWrite);
+        context->lastStatus = 1;
+        if (errno == EAGAIN) fprintf(stderr, "Couldn't create the process: process limit exceeded.\n");
+        else if (errno == ENOMEM) fprintf(stderr, "Not enough memory to create the process.\n");
+        else {
+            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): fork() system call failed. Terminating...\n");
+            exit(3);
+        }
+    }
+    else if (childPid == 0) {   // We're in the child process now
+        // Stop ignoring signals
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+
+        char* semname = (char*) malloc(33); // Name of the semaphore. It should be of the form '/seashell10_childPID'
+        if (!semname) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+
+        if (sprintf(semname, "/seashell10_%d", getpid()) < 0) {
+            fprintf(stderr, "FATAL ERROR (UNKNOWN): Unable to create the name for the semaphore (child). Terminating...\n");
+            exit(3);
+        }
+
+        // Open the semaphore
+        if ((mainBusy = sem_open(semname, O_CREAT, S_IRWXU, 0)) == SEM_FAILED) {
+            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to initiate a semaphore (child). Terminating...\n");
+            exit(3);
+        }
+
+        sem_wait(mainBusy); // Wait until the parent does all the preliminary tasks...
+
+        if (sem_close(mainBusy) != 0) { // ...then close the semaphore...
+            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to close the semaphore (child). Terminating...\n");
+            exit(3);
+        }
+        free(semname);
+
+        applySchedOptions(&newP->sched, 0);  // Apply the scheduling settings (if any); if some of them fail, we still run the command
+        if (applyLimitOptions(&newP->limits) != 0) _exit(126);  // But never without the requested resource limits
+
+        // Redirect the standard input to the here-document/here-string, if there is one
+        if (opts != NULL && opts->stdinFd >= 0 && dup2(opts->stdinFd, STDIN_FILENO) < 0) {
+            fprintf(stderr, "Unable to redirect the standard input: %s.\n", strerror(errno));
+            _exit(-1);
+        }
+        // Send the output to the capture pipe, if it is captured
+        if (outWrite >= 0 && (dup2(outWrite, STDOUT_FILENO) < 0 || dup2(outWrite, STDERR_FILENO) < 0)) {
+            fprintf(stderr, "Unable to redirect the output: %s.\n", strerror(errno));
+            _exit(-1);
+        }
+
+        // ...and execute the command.
+        execv(command, args);
+        _exit(-1);  // If execv() failed, exit immediately
+    }
+    else if (childPid > 0) {    // We're in the parent process
+        if (outWrite >= 0) close(outWrite); // Only the child writes into the capture pipe
+        char* semname = (char*) malloc(33); // Name of the semaphore. It should be of the form '/seashell10_childPID'
+        if (!semname) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+
+        if (sprintf(semname, "/seashell10_%d", childPid) < 0) {
+            fprintf(stderr, "FATAL ERROR (UNKNOWN): Unable to create the name for the semaphore (parent). Terminating...\n");
+            exit(3);
+        }
+
+        // Open the semaphore
+        if ((mainBusy = sem_open(semname, O_CREAT, S_IRWXU, 0)) == SEM_FAILED) {
+            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to initiate a semaphore (parent). Terminating...\n");
+            exit(3);
+        }
+
+        newP->pid = childPid;   // Update the PID stored in the record
+        // Obtain a pidfd for the child: unlike the PID, it can never refer to another process once the child is reaped.
+        // Since we haven't reaped the child yet, the PID cannot have been reused at this point.
+        newP->pidfd = (int) syscall(SYS_pidfd_open, childPid, 0);
+        if (newP->pidfd < 0 && errno != ENOSYS) {
+            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): pidfd_open() system call failed. Terminating...\n");
+            exit(3);
+        }
+        if (clock_getcpuclockid(childPid, &newP->cpuClock) != 0) newP->cpuClock = -1;   // (the CPU time is then not published)
+        _printProcInfo(newP, jobNum, background, running, 0);   // Print the status update: the process is running
+
+        if (newP->timed) openPerfCounters(newP, 1);  // The counters will be enabled by the execv() in the child
+
+        if (setpgid (childPid, childPid) < 0) { // Place the child process in its own process group
+            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to set the PGID for the child. Terminating...\n");
+            exit(3);
+        }
+
+        // Start the countdown of the timeout, if there is one (the signals are sent to the process group, so it must exist by now)
+        if (opts != NULL && opts->timeout.timeout > 0 && watchChildren() == 0) startTimeout(newP, &opts->timeout);
+
+        if (!background) {  // If the process is to be executed in the foreground...
+            if (interactive && tcsetpgrp(STDIN_FILENO, childPid) < 0) {    // ...hand the control over the terminal to the child process
+                fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to set the terminal foreground PGID. Terminating...\n");
+                exit(3);
+            }
+        }
+
+        sem_post(mainBusy); // Let the child process know that it may execute the command
+        context->lastStatus = 0; // A background job is successfully started; a foreground one sets the status when it finishes
+        exportJobs();   // Publish the new job
+
+        if (sem_close(mainBusy) != 0) { // Close the semaphore
+            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to close the semaphore (parent). Terminating...\n");
+            exit(3);
+        }
+        free(semname);
+
+        if (!background) {  // If the process is to be executed in the foreground...
+            currentProc = newP; // Update currentProc correspondingly
+            updateStatus(); // busy wait
+            context->lastStatus = exitStatusOf(newP);
+            // If the job is timed and has finished, report right away; if it was stopped, it will be reported when it finishes
+            if (newP->timed && newP->status != running && newP->status != stopped) reportJobTime(newP);
+            // After the process stopped/terminated, we need to return the control over the terminal to the shell
+            if (interactive && tcsetpgrp(STDIN_FILENO, getpid()) < 0) {
+                fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to set the terminal foreground PGID. Terminating...\n");
+                exit(3);
+            }
+        }
+    }
+
+    // Stop ignoring signals
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+}
+
+/*
+ * resumeProcess() - resumes a stopped process in the background/foreground, or brings a
+ * currently running background process to the foreground
+ * Called by the 'bg' and 'fg' built-in commands.
+ * 
+ * Arguments:
+ * jN - job number of the targeted process;
+ * backgr - background flag;
+ * timed - if not TIME_NONE, the resource usage of the process while it is in the foreground is reported in this format ('time fg');
+ * timeout - if not NULL and --timeout was given, the new deadline of the process (counted from now).
+ */
+void resumeProcess(unsigned int jN, int backgr, int timed, timeoutOptions* timeout) {
+    timeSample from, to;    // resource usage before and after the process was in the foreground
+
+    // Temporarily ignore signals
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    // Find the relevant job record
+    processRecord* p = procs;
+    unsigned int i;
+    for (i = 1; i < jN; i++) p = p->next;
+
+    if (p->status != running && p->status != stopped) { // A finished job still in the table: its captured output has not been shown
+        if (backgr) printf("The job has already finished.\n");
+        else {  // 'fg' shows the output, and the job is gone
+            _printProcInfo(p, jN, p->background, p->status, p->exitCode);
+            showOutput(p, 0);
+            if (p->statusSlot == STATUS_SLOT_NONE) removeProcess(p);
+        }
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        return;
+    }
+
+    // Set the new deadline, if it was given
+    if (timeout != NULL && timeout->set && (watchChildren() != 0 || startTimeout(p, timeout) != 0)) timeout = NULL;
+
+    if (p->background == backgr && p->status == running) {
+        if (timeout != NULL && timeout->set) {  // Only the deadline has changed
+            _printProcLine(p, jN, backgr, running, 0);
+            _printTimeoutInfo(p);
+            printf("\n");
+        }
+        else printf("Nothing to do.\n");
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        return;
+    }
+    
+    if (p->status == running) printf("Attempt to bring to ");
+    else printf("Attempt to resume in ");
+
+    if (backgr) printf("background: ");
+    else printf("foreground: ");
+
+    p->background = backgr;
+
+    _printProcInfo(p, jN, backgr, running, 0);
+    if (!backgr && p->output != NULL) writeOutput(p->output, p->output->shown);  // Replay the output captured in the background
+
+    if (timed && !backgr) {
+        p->timed = TIME_NONE;   // Only the time in the foreground is reported (once, below), even if the job was launched with 'time'
+        openPerfCounters(p, 0); // Start counting right now (unless the counters are already open)
+        sampleJob(p, &from);
+    }
+
+    if (p->status != running) {  // If the process is stopped, we need to resume it by sending SIGCONT to it
+        if (signalProcess(p, SIGCONT) != 0) {
+            fprintf(stderr, "Unable to resume process: unable to send the signal.\n");
+            return;
+        } else p->status = running;
+    }
+    exportJobs();   // Publish the new status
+
+    if (!backgr) {  // If the process is to be executed in the foreground...
+        if (interactive && tcsetpgrp(STDIN_FILENO, p->pid) < 0) {  // Hand the control over the terminal to the process
+            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to set the terminal foreground PGID. Terminating...\n");
+            exit(3);
+        }
+        currentProc = p;    // Update currentProc
+        updateStatus(); // busy wait
+        context->lastStatus = exitStatusOf(p);
+        if (timed) {
+            sampleJob(p, &to);
+            printTimeReport(&from, &to, timed);
+        }
+        if (interactive && tcsetpgrp(STDIN_FILENO, getpid()) < 0) {    // Return the control over the terminal to the shell
+            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to set the terminal foreground PGID. Terminating...\n");
+            exit(3);
+        }
+    }
+
+    // Stop ignoring signals
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+}
+
+/*
+ * reniceProcess() - changes the scheduling settings of a live job
+ * Called by the 'renice' built-in command.
+ *
+ * Arguments:
+ * jN - job number of the targeted process;
+ * sched - the new settings; only the settings which are set are changed.
+ */
+void reniceProcess(unsigned int jN, schedOptions* sched) {
+    // Find the relevant job record
+    processRecord* p = procs;
+    unsigned int i;
+    for (i = 1; i < jN; i++) p = p->next;
+
+    if (p->status != running && p->status != stopped) {
+        printf("renice: the job has already finished.\n");
+        return;
+    }
+
+    // Even if some of the settings fail, the others have been applied by now; only those are kept in 'sched'
+    applySchedOptions(sched, p->pid);
+
+    // Remember the new settings (together with the old ones that were not changed), so that they are shown by 'jobs'
+    mergeSchedOptions(sched, &p->sched);
+    freeSchedOptions(&p->sched);
+    p->sched = *sched;
+    initSchedOptions(sched);    // p->sched took over the CPU list
+
+    _printProcInfo(p, jN, p->background, p->status, p->exitCode);
+}
+
+// waitInterrupted() - SIGINT handler used by the 'wait' and 'output --follow' built-in commands; it makes poll() return with EINTR
+void waitInterrupted(int sig) {
+    (void) sig;
+    waitWasInterrupted = 1;
+}
+
+/*
+ * waitJobs() - waits until the given background jobs finish
+ * Called by the 'wait' built-in command.
+ *
+ * Arguments:
+ * jobs - job numbers of the targeted jobs; NULL means all the jobs in the job table
+ * count - number of items in 'jobs'
+ * any - if non-zero, return as soon as any one of the jobs finishes (wait -n)
+ *
+ * The pidfds of all the targeted jobs are polled together, so the shell sleeps until one of exactly these
+ * jobs terminates, without waking up for other children. Without pidfd support, the shell wakes up on every SIGCHLD instead
+ * (see watchChildren()); either way, all the targeted jobs are checked after every wakeup. Stopped jobs are not waited for.
+ * The status updates are printed before the next command prompt, as usual. Ctrl-C interrupts the waiting.
+ * The exit status ($?) becomes the one of the last job that finished (see exitStatusOf()), or 130 if the waiting was interrupted.
+ */
+void waitJobs(unsigned int* jobs, unsigned int count, int any) {
+    processRecord* p;
+    unsigned int i, j, n = 0;
+    struct pollfd* fds;
+    processRecord** targets;
+    struct sigaction sa, oldsa;
+    int noPidfd = 0;    // non-zero if some of the jobs have no pidfd
+    int watchFd = -1;   // the SIGCHLD self-pipe, polled for such jobs
+    char buf[64];
+
+    if (jobs == NULL) { // All the jobs in the table
+        count = nextJobNum - 1;
+    }
+
+    fds = (struct pollfd*) malloc((count + 1) * sizeof(struct pollfd));
+    targets = (processRecord**) malloc((count + 1) * sizeof(processRecord*));
+    if (!fds || !targets) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+
+    // Collect the jobs which are still running
+    for (i = 0; i < count; i++) {
+        unsigned int jN = jobs ? jobs[i] : i + 1;
+        p = procs;
+        for (j = 1; j < jN; j++) p = p->next;
+
+        if (p->status == stopped) printf("wait: job %u is stopped; not waiting for it.\n", jN);
+        if (p->status != running) continue;
+
+        targets[n] = p;
+        fds[n].fd = p->pidfd;   // pidfds without support (-1) are ignored by poll(); such jobs are handled below
+        fds[n].events = POLLIN; // a pidfd becomes readable when the process terminates
+        fds[n].revents = 0;
+        if (p->pidfd < 0) noPidfd = 1;
+        n++;
+    }
+
+    // The jobs without a pidfd wake the shell up through the SIGCHLD self-pipe, which is polled after the pidfds
+    if (noPidfd && watchChildren() == 0) watchFd = childSignalPipe[0];
+
+    // Let Ctrl-C interrupt the waiting instead of killing the shell
+    sa.sa_handler = waitInterrupted;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = 0;    // no SA_RESTART: we want poll() to fail with EINTR
+    sigaction(SIGINT, &sa, &oldsa);
+    waitWasInterrupted = 0;
+
+    while (n > 0) {
+        // (a job without a pidfd may have finished before the self-pipe was set up, so the jobs are checked before the first sleep too)
+        updateStatus(); // Reap the terminated processes and update the job table
+
+        // Drop the jobs which are not running anymore from the set of the polled pidfds
+        for (i = 0; i < n; ) {
+            if (targets[i]->status != running) {
+                context->lastStatus = exitStatusOf(targets[i]);  // $? is the status of the last job that finished (124 if it timed out)
+                n--;
+                targets[i] = targets[n];
+                fds[i] = fds[n];
+                fds[i].revents = 0;
+                if (any) n = 0; // wait -n: one job is enough
+            }
+            else i++;
+        }
+        if (n == 0) break;
+
+        fds[n].fd = watchFd;
+        fds[n].events = POLLIN;
+        fds[n].revents = 0;
+        if (noPidfd && watchFd < 0) {
+            // No self-pipe either: wait for any child without reaping it (updateStatus() reaps it), then check all the jobs
+            siginfo_t info;
+            if (waitid(P_ALL, 0, &info, WEXITED | WNOWAIT) != 0) {
+                if (errno == EINTR && !waitWasInterrupted) continue;    // (SIGCHLD of other children, etc.)
+                if (errno == EINTR) break;
+                fprintf(stderr, "\nFATAL ERROR (UNKNOWN): waitid() system call failed. Terminating...\n");
+                exit(3);
+            }
+        }
+        else if (pollWithCapture(fds, watchFd >= 0 ? n + 1 : n) < 0) {  // Sleep until at least one of the jobs terminates (the captured output is drained meanwhile)
+            if (errno == EINTR) break;
+            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): poll() system call failed. Terminating...\n");
+            exit(3);
+        }
+        if (watchFd >= 0) while (read(watchFd, buf, sizeof(buf)) > 0);
+    }
+
+    if (waitWasInterrupted) context->lastStatus = 128 + SIGINT;
+    sigaction(SIGINT, &oldsa, NULL);
+    free(fds);
+    free(targets);
+}
+
+// getdir() - returns the string containing the current working directory
+char* getdir() {
+    unsigned long size = 0; // Current size of the buffer
+    char* status;   // Status of the execution of getcwd()
+    char* buffer = NULL;
+
+    do {
+        size += 256;    // Increase the size of the buffer
+        buffer = (char*) malloc(size);  // Allocate memory for the buffer
+        if (!buffer) {
+           fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+           exit(2);
+        }
+
+        status = getcwd(buffer, size);  // Try to get the working directory by calling getcwd()
+        if (status < 0 && errno != ERANGE) {    // Something unexpected & bad happened
+            free(buffer);
+            fprintf(stderr, "FATAL ERROR (UNKNOWN): getcwd() system call failed. Terminating...\n");
+            exit(3);
+            return NULL;
+        }
+
+        if (status >= 0) break; // Hurray, we obtained the working directory successfully
+
+        free(buffer);
+    } while (1);    // If we got an error (status < 0), and it is ERANGE, it just means that the size of the buffer wasn't enough,
+                    // so we can increase it and try again
+    return buffer;
+}
+
+/*
+ * splitWords() - splits the string str into words the way strsplit() does (see below); besides, if hereOps is not NULL, finds
+ * the here-document/here-string operators ("<<", "<<-", "<<<") which begin a word unquoted. Since the quotes are removed from the
+ * words, "<<EOF" can't be told from \"<<EOF\" afterwards, so the operators are noted here: *hereOps is set to a NULL-terminated
+ * array (allocated with malloc()) of pointers to the first character after each such operator (see extractHereInput()).
+ */
+char** splitWords(char* str, const char* delims, char*** hereOps) {
+    if (strpbrk(delims, "\"\\") != NULL) {  // Double quotes and the backslash cannot be delimiters
+       fprintf(stderr, "FATAL ERROR [strsplit()]: An illegal character used as a delimiter. You cannot use \" and \\ as delimiters. Terminating...\n");
+       exit(5);
+    }
+
+    unsigned int bufsize = 16, pos = 0; // bufsize - size of the array of strings to be returned, pos - current position in this array of strings
+    char** parts = (char**) malloc(bufsize * sizeof(char*));    // Allocate memory for the array of strings,
+                                                                // i.e. array of pointers to char. To make the program more efficient,
+                                                                // we will not copy each part of the initial string into the new memory block,
+                                                                // but instead we will just alter the str string itself, insert '\0' chars where necessary,
+                                                                // and fill the 'parts' array with pointers to relevant chars in the middle of 'str'
+    char* temp; // Auxiliary variable to store the string to be added to 'parts'
+    char* curchar = str;    // Currently processed character
+    unsigned int shift; // We will need this when we delete some characters (e.g. '\' and '"') from the initial string
+    int doublequotes = 0;   // it is non-zero if double quotes were opened but not closed yet
+    char** ops = NULL;  // the here-document/here-string operators found (see hereOps)
+    unsigned int nops = 0;
+
+    if (hereOps != NULL) ops = (char**) malloc(bufsize * sizeof(char*));   // (there can't be more operators than parts)
+    if (!parts || (hereOps != NULL && !ops)) {
+       fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+       exit(2);
+    }
+
+	while (*curchar != '\0') {  // Until we reach the end of the initial string
+		curchar += strspn(curchar, delims); // Skip all the delimiters in the beginning of the new section of the string
+        temp = curchar; // The new part starts here
+        shift = 0;  // Set shift to 0
+        if (*curchar == '\0') break;    // We may have reached the end of the initial string; in this case, we're done
+        if (ops != NULL && curchar[0] == '<' && curchar[1] == '<') {   // An unquoted here-document/here-string operator
+            ops[nops++] = curchar + (curchar[2] == '<' || curchar[2] == '-' ? 3 : 2);
+        }
+
+        while (*curchar != '\0') {  // Break if we have reached the end of the initial string
+            // If the current character is...
+            if (*curchar == '\\') { // If the current character is an escape character, i.e. the backslash...
+                curchar++;  // 1) go to the next character
+                shift++;    // 2) increase the shift (since we're deleting the backslash)
+                *(curchar - shift) = *curchar;  // 3) just copy the character after the backslash without processing it normally
+                if (*curchar != '\0') curchar++;    // 4) go to the next character (unless we're at the end of the initial string)
+            }
+            else if ((strchr(delims, *curchar) != NULL) && !doublequotes) { // If the current character is a delimiter AND the double quotes have not been opened...
+                break;  // the end of the section reached, save this section to 'parts' and start a new one
+            }
+            else if (*curchar == '"') { // If the current character is a double quote...
+                doublequotes = !doublequotes;   // 1) switch the 'doublequotes' flag
+                curchar++;  // 2) advance to the next character
+                shift++;    // 3) increase the shift since we deleted the double quote
+            }
+            else {  // For any other character:
+                *(curchar - shift) = *curchar;  // 1) copy the character to its new position
+                curchar++;  // 2) go to the next character
+            }
+        }
+
+        // In any case, we need to mark the end of the current section with a '\0', but then, unless we're at the end of the
+        // initial string, we need to advance the curchar
+        if (*curchar != '\0') {
+            *(curchar - shift) = '\0';
+            curchar++;
+        }
+        else *(curchar - shift) = '\0';
+
+        parts[pos] = temp;  // save the current section
+        pos++;
+
+        if (pos >= bufsize) {   // If the current size of the 'parts' array is exceeded, we will need to increase it
+			bufsize += 16;
+			parts = (char**) realloc(parts, bufsize * sizeof(char*));
+			if (ops != NULL) ops = (char**) realloc(ops, bufsize * sizeof(char*));
+			if (!parts || (hereOps != NULL && !ops)) {
+				fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+				exit(2);
+			}
+		}
+	}
+
+	parts[pos] = NULL;  // The last item of the array should be the NULL pointer
+	if (hereOps != NULL) {
+		ops[nops] = NULL;
+		*hereOps = ops;
+	}
+	return parts;
+}
+
+/*
+ * strsplit() - splits the string str into parts, using the chars in the delims string as delimiters
+ * Different parts of the string are considered to be separated by characters contained in delims, in any numbers or order.
+ * Any part of the string enclosed in double quotes ("some part") will never be separated, even if it contains delimiters. In such
+ * case, the double quotes will be removed from the result.
+ * All the characters, including delimiters and double quotes, can be escaped using '\'. In this case, they will be treated "as is", i.e.
+ * a delimiter character will not separate different parts of a string, and a double quote will not be seen as a double quote.
+ * A '\' can also be escaped (i.e. '\\' is '\').
+ * 
+ * The last item in the resulting array will always be the NULL pointer
+ */
+char** strsplit(char* str, const char* delims) {
+    return splitWords(str, delims, NULL);
+}
+
+/*
+ * findExecutable() - locates the executable for an external command
+ *
+ * Arguments:
+ * name - the name of the command
+ * verbose - if non-zero, every location that was checked is reported to stderr
+ *
+ * If the name contains '/', it is the path to the executable; otherwise, the executable is searched for in the directories
+ * listed in the PATH environment variable. Returns the path to the executable (allocated with malloc()), or NULL if it was not found.
+ */
+char* findExecutable(const char* name, int verbose) {
+    char* pathvar;  // the string to store the content of the PATH environment variable
+    char* command;  // the path to the executable to be run
+    char** paths;   // components of the PATH environment variable
+    char** searchpaths; // array of locations where the executable is to be searched for
+    unsigned int i; // integer counter
+
+    // If name does not contain '/', we will look for the file named (name) in the directories contained in the PATH environment variable
+    // Otherwise, we'll try to locate the executable exactly where name points to
+    if (strchr(name, '/') == NULL) {
+        pathvar = (char*) malloc(strlen(getenv("PATH") ? getenv("PATH") : "") + 1);
+
+        if (!pathvar) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+
+        strcpy(pathvar, getenv("PATH") ? getenv("PATH") : "");    // Copy the content of the PATH variable
+        paths = strsplit(pathvar, ":"); // Split the PATH variable into the array of strings; each of those strings is a path to a directory
+
+        i = 0;
+        while (paths[i] != NULL) i++;
+        // Here, i contains the number of different paths in the PATH variable
+
+        searchpaths = (char**) malloc((i + 1) * sizeof(char*)); // i paths + 1 NULL pointer
+
+        if (!searchpaths) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+
+        i = 0;
+        while (paths[i] != NULL) {  // Go through the whole 'paths' array
+            // Each string in the 'searchpaths' will contain the respective path from 'paths' + '/' + name + '\0'
+            searchpaths[i] = (char*) malloc(strlen(paths[i]) + 2 + strlen(name));
+            if (!(searchpaths[i])) {
+                fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+                exit(2);
+            }
+
+            strcpy(searchpaths[i], paths[i]);
+            strcat(searchpaths[i], "/");
+            strcat(searchpaths[i], name);
+            i++;
+        }
+        searchpaths[i] = NULL;  // 'searchpaths' should end with the NULL pointer
+
+        free(pathvar);
+        free(paths);
+    }
+    else {  // The case when name contains a '/'
+        // 'searchpaths' array will contain a copy of name and a NULL pointer
+        searchpaths = (char**) malloc(2 * sizeof(char*));
+
+        if (!searchpaths) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+
+        searchpaths[0] = (char*) malloc(strlen(name) + 1);
+        if (!searchpaths[0]) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+
+        strcpy(searchpaths[0], name);
+        searchpaths[1] = NULL;
+    }
+
+    // By default, we suppose that the executable was not found; we signify this by assigning the NULL pointer to 'command'
+    command = NULL;
+    i = 0;
+    while (searchpaths[i] != NULL) {
+        if (verbose) fprintf(stderr, "File [%s]: ", searchpaths[i]);
+        // Does the file at searchpaths[i] exist and do we have access to it?
+        if (access(searchpaths[i], F_OK) != 0) {
+            if (errno != EACCES && errno != ELOOP && errno != ENAMETOOLONG && errno != ENOENT && errno != ENOTDIR) {  // Unexpected error
+                fprintf(stderr, "\nFATAL ERROR (UNKNOWN): access() system call failed. Terminating...\n");
+                exit(3);
+            }
+            if (verbose) {
+                if (errno == EACCES) fprintf(stderr, "access denied.\n");
+                else if (errno == ELOOP) fprintf(stderr, "too many symbolic links.\n");
+                else if (errno == ENAMETOOLONG) fprintf(stderr, "the path is too long.\n");
+                else if (errno == ENOENT) fprintf(stderr, "not found.\n");
+                else fprintf(stderr, "wrong path.\n");
+            }
+            i++;
+            continue;   // Go to the next path in 'searchpaths' (if such exists)
+        } else {    // The file at searchpaths[i] exists
+            if (verbose) fprintf(stderr, "exists; ");
+            if (access(searchpaths[i], X_OK) != 0) {    // Do we have the permission to execute the file at searchpaths[i]?
+                if (errno == EFAULT || errno == EINVAL || errno == EIO || errno == ENOMEM || errno == ETXTBSY) {
+                    fprintf(stderr, "\nFATAL ERROR (UNKNOWN): access() system call failed. Terminating...\n");
+                    exit(3);
+                } else {
+                    if (verbose) fprintf(stderr, "cannot be executed.\n");
+                    i++;
+                    continue;   // Go to the next path in 'searchpaths' (if such exists)
+                }
+            } else {
+                // We can execute the file at searchpaths[i], so we update 'command' accordingly
+                if (verbose) fprintf(stderr, "executable.\n");
+                command = (char*) malloc(strlen(searchpaths[i]) + 1);
+                if (!command) {
+                    fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+                    exit(2);
+                }
+                strcpy(command, searchpaths[i]);
+                break;
+            }
+        }
+        i++;
+    }
+
+    // Freeing all the allocated resources
+    i = 0;
+    while (searchpaths[i] != NULL) {
+        free(searchpaths[i]);
+        i++;
+    }
+    free(searchpaths);
+
+    return command;
+}
+
+/*
+ * runQuietly() - runs a foreground external command of the one-shot mode (-c) and waits for it. Unlike newProcess(), it doesn't
+ * make a job of the command: there are no semaphores, no job table record and no status updates, only the exit status in $?.
+ *
+ * Arguments:
+ * args - command line arguments; args[0] is the name of the command
+ * opts - the settings to be applied to the process
+ */
+void runQuietly(char** args, launchOptions* opts) {
+    char* command = findExecutable(args[0], 0); // the path to the executable to be run
+    pid_t childPid;
+    int status;
+
+    if (command == NULL) {
+        fprintf(stderr, "seashell: [%s]: not a command\n", args[0]);
+        context->lastStatus = 127;
+        return;
+    }
+    mergeLimitOptions(&opts->limits, &jobLimits);
+
+    fflush(stdout); // What the earlier commands printed comes before the output of this one
+    if ((childPid = fork()) < 0) {
+        fprintf(stderr, "seashell: unable to create the process: %s.\n", strerror(errno));
+        context->lastStatus = 1;
+    }
+    else if (childPid == 0) {   // The child: the same settings as newProcess() applies, then the command
+        signal(SIGINT, SIG_DFL);
+        signal(SIGQUIT, SIG_DFL);
+        signal(SIGTSTP, SIG_DFL);
+        signal(SIGTTIN, SIG_DFL);
+        signal(SIGTTOU, SIG_DFL);
+        applySchedOptions(&opts->sched, 0);
+        if (applyLimitOptions(&opts->limits) != 0) _exit(126);
+        if (opts->stdinFd >= 0 && dup2(opts->stdinFd, STDIN_FILENO) < 0) _exit(126);
+        execv(command, args);
+        _exit(126);
+    }
+    else {
+        while (waitpid(childPid, &status, 0) < 0) {
+            if (errno != EINTR) {
+                fprintf(stderr, "\nFATAL ERROR (UNKNOWN): waitpid() system call failed. Terminating...\n");
+                exit(3);
+            }
+        }
+        context->lastStatus = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+    }
+    free(command);
+}
+
+/*
+ * executeExternal() - locates the executable for an external command and launches it with newProcess()
+ *
+ * Arguments:
+ * args - command line arguments; args[0] is the name of the command
+ * bckgr - background flag
+ * opts - the settings to be applied to the process; NULL if there are none
+ */
+void executeExternal(char** args, int bckgr, launchOptions* opts) {
+    char* command;  // the path to the executable to be run
+
+    // In the one-shot mode, a foreground command is not a job, unless the shell has to watch it (a deadline, or 'time')
+    if (oneShot && !bckgr && opts->timeout.timeout <= 0 && !opts->timed) {
+        runQuietly(args, opts);
+        return;
+    }
+
+    command = findExecutable(args[0], 1);
+
+    if (command == NULL) {  // We were unable to find the executable
+        printf("[%s]: not a command\n", args[0]);
+        context->lastStatus = 127;
+    } else {    // We found the executable, and the path to it is stored in 'command'
+        fprintf(stderr, "Executing [%s]...\n", command);
+
+        // Executing the command
+        newProcess(command, args, bckgr, opts);
+        free(command);
+    }
+}
+
+/*
+ * stripBackground() - determines whether the command line had the '&' suffix; if there was
+ * such suffix, deletes this suffix from the arguments array.
+ * Returns the background flag: 1 if there was the suffix, 0 otherwise.
+ */
+int stripBackground(char** args) {
+    unsigned int i = 0;
+    int bckgr = 0;
+
+    while (args[i] != NULL) i++;
+    if (i > 0) {
+        i--;
+        if (strlen(args[i]) > 0 && (args[i][strlen(args[i]) - 1] == '&')) {
+            bckgr = 1;
+            if (strlen(args[i]) < 2) {
+                args[i] = NULL;
+            }
+            else {
+                args[i][strlen(args[i]) - 1] = '\0';
+            }
+        }
+    }
+    return bckgr;
+}
+
+// Types of the standard input redirections found by extractHereInput()
+#define HERE_ERROR (-1) // malformed redirection
+#define HERE_NONE 0 // no redirection
+#define HERE_DOC 1  // here-document: "<<DELIM"
+#define HERE_DOC_STRIPTABS 2    // here-document with the leading tabs removed from every line: "<<-DELIM"
+#define HERE_STRING 3   // here-string: "<<<word"
+
+#define HERE_PIPE_MAX 4096  // Here-documents up to this size are passed through a pipe; larger ones, through a sealed memfd
+
+/*
+ * extractHereInput() - finds a here-document ("<<DELIM", "<<-DELIM") or a here-string ("<<<word") among the arguments
+ * and removes it from them. The operator may be either attached to its word or separated from it with whitespace.
+ * If there are several such redirections, the last one counts. Only the operators that were not quoted count, so "<<EOF" (quoted)
+ * is an ordinary argument.
+ *
+ * Arguments:
+ * args - command line arguments (modified in place)
+ * hereOps - the unquoted operators found by splitWords() when the arguments were split
+ * word - here the delimiter of the here-document or the here-string itself is stored
+ *
+ * Returns one of the HERE_... values; if the operator is not followed by a word, prints the error message and returns HERE_ERROR.
+ */
+int extractHereInput(char** args, char** hereOps, char** word) {
+    unsigned int i = 0, j = 0, k;
+    int type = HERE_NONE, t;
+    size_t oplen;
+
+    *word = NULL;
+    while (args[i] != NULL) {
+        // (the words are at least two characters apart, so an operator that ends 2 or 3 characters into this word is its own)
+        for (k = 0; hereOps[k] != NULL && hereOps[k] != args[i] + 2 && hereOps[k] != args[i] + 3; k++);
+        if (hereOps[k] == NULL) {
+            args[j++] = args[i++];  // Not a redirection: keep the argument
+            continue;
+        }
+        oplen = hereOps[k] - args[i];
+        if (oplen == 2) t = HERE_DOC;
+        else if (args[i][2] == '<') t = HERE_STRING;
+        else t = HERE_DOC_STRIPTABS;
+
+        type = t;
+        if (args[i][oplen] != '\0') {   // The word is attached to the operator
+            *word = args[i] + oplen;
+            i++;
+        }
+        else if (args[i + 1] != NULL) { // The word is the next argument
+            *word = args[i + 1];
+            i += 2;
+        }
+        else {
+            printf("%s: the redirection requires a word after it.\n", args[i]);
+            return HERE_ERROR;
+        }
+    }
+    args[j] = NULL;
+
+    if (type != HERE_NONE && type != HERE_STRING && **word == '\0') {
+        printf("<<: the here-document delimiter cannot be empty.\n");
+        return HERE_ERROR;
+    }
+    return type;
+}
+
+#define INPUT_BUFFER_SIZE 4096   // Size of the buffer of the command line input
+
+/*
+ * The command lines (and the here-documents) are read from the standard input through this buffer rather than through stdin,
+ * so that the shell can tell whether the next line has already been read (see inputPending()) without looking inside FILE.
+ */
+char inputBuffer[INPUT_BUFFER_SIZE];
+size_t inputPos = 0, inputLength = 0;   // The unread part of the buffer is inputBuffer[inputPos..inputLength)
+
+// inputPending() - returns non-zero if some input has been read into the buffer but not taken yet
+int inputPending() {
+    return inputPos < inputLength;
+}
+
+/*
+ * readInputLine() - reads a line from the standard input, the same way as getline() does
+ * Arguments:
+ * line, cap - the buffer for the line and its size (allocated/enlarged with realloc() as necessary, just like with getline())
+ *
+ * The standard output is flushed first (the prompt has to be seen). Returns the length of the line, including the '\n' (unless the
+ * input ended without it); -1 at the end of the input, and -2 on a read error.
+ */
+ssize_t readInputLine(char** line, size_t* cap) {
+    size_t len = 0, n;
+    char* eol;
+    ssize_t got;
+
+    fflush(stdout);
+    while (1) {
+        if (inputPos == inputLength) {  // Refill the buffer
+            while ((got = read(STDIN_FILENO, inputBuffer, sizeof(inputBuffer))) < 0 && errno == EINTR);
+            if (got < 0) return -2;
+            if (got == 0 && len == 0) return -1;
+            if (got == 0) break;    // The last line has no '\n'
+            inputPos = 0;
+            inputLength = got;
+        }
+
+        eol = (char*) memchr(inputBuffer + inputPos, '\n', inputLength - inputPos);
+        n = eol != NULL ? (size_t) (eol - inputBuffer) + 1 - inputPos : inputLength - inputPos;
+        if (*line == NULL || len + n + 1 > *cap) {
+            while (len + n + 1 > *cap) *cap = *cap ? *cap * 2 : 128;
+            *line = (char*) realloc(*line, *cap);
+            if (!*line) {
+                fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+                exit(2);
+            }
+        }
+        memcpy(*line + len, inputBuffer + inputPos, n);
+        len += n;
+        inputPos += n;
+        if (eol != NULL) break;
+    }
+    (*line)[len] = '\0';
+    return len;
+}
+
+/*
+ * appendHereLine() - appends a line (and a '\n') to the body of a here-document
+ * Arguments:
+ * body, len, cap - the body, its length and the size of the allocated memory (updated as necessary)
+ * line - the line to append, without the '\n'
+ * stripTabs - if non-zero, the leading tabs of the line are removed
+ */
+void appendHereLine(char** body, size_t* len, size_t* cap, const char* line, int stripTabs) {
+    size_t n;
+
+    if (stripTabs) line += strspn(line, "\t");
+    n = strlen(line);
+
+    while (*len + n + 2 > *cap) {
+        *cap = *cap ? *cap * 2 : 256;
+        *body = (char*) realloc(*body, *cap);
+        if (!*body) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+    }
+    memcpy(*body + *len, line, n);
+    *len += n;
+    (*body)[(*len)++] = '\n';
+    (*body)[*len] = '\0';
+}
+
+/*
+ * readHereDoc() - reads the lines of a here-document from the standard input until the line equal to the delimiter
+ * Returns the body (allocated with malloc()); its length is stored in len.
+ */
+char* readHereDoc(const char* delim, int stripTabs, size_t* len) {
+    char* body = NULL;
+    size_t cap = 0;
+    char* line = NULL;
+    size_t zero = 0;
+    ssize_t n;
+
+    *len = 0;
+    appendHereLine(&body, len, &cap, "", 0);    // make sure the body is allocated even if it is empty...
+    *len = 0;   // ...but doesn't contain the '\n'
+
+    while (1) {
+        if (interactive) printf("> ");  // Continuation prompt
+        if ((n = readInputLine(&line, &zero)) < 0) {
+            printf("<<: the here-document was ended by the end of file (wanted [%s]).\n", delim);
+            break;
+        }
+        if (n > 0 && line[n - 1] == '\n') line[n - 1] = '\0';
+        if (strcmp(stripTabs ? line + strspn(line, "\t") : line, delim) == 0) break;
+        appendHereLine(&body, len, &cap, line, stripTabs);
+    }
+
+    free(line);
+    return body;
+}
+
+/*
+ * makeHereInput() - creates a file descriptor from which the body of a here-document/here-string can be read
+ * Small bodies are written into a pipe (they always fit into the pipe buffer, so the write never blocks). Larger bodies are written
+ * into an anonymous memory file (memfd_create()), which is then sealed and rewound: the child reads the pages directly, no temporary
+ * file ever touches the disk, and nobody can change the content after it was handed over.
+ * Returns the file descriptor (close-on-exec; newProcess() duplicates it as the standard input of the child), or -1 on failure.
+ */
+int makeHereInput(const char* body, size_t len) {
+    int fds[2];
+    int fd;
+    ssize_t n;
+    size_t done = 0;
+
+    if (len <= HERE_PIPE_MAX) {
+        if (pipe2(fds, O_CLOEXEC) != 0) return -1;
+        while (done < len) {
+            if ((n = write(fds[1], body + done, len - done)) < 0) {
+                if (errno == EINTR) continue;
+                close(fds[0]);
+                close(fds[1]);
+                return -1;
+            }
+            done += n;
+        }
+        close(fds[1]);  // The reader will see the end of file after the body
+        return fds[0];
+    }
+
+    if ((fd = memfd_create("seashell-here", MFD_CLOEXEC | MFD_ALLOW_SEALING)) < 0) return -1;
+    while (done < len) {
+        if ((n = write(fd, body + done, len - done)) < 0) {
+            if (errno == EINTR) continue;
+            close(fd);
+            return -1;
+        }
+        done += n;
+    }
+    if (fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0 || lseek(fd, 0, SEEK_SET) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * executeCommand() - executes a parsed command line: either runs a built-in command or launches an external one
+ *
+ * Arguments:
+ * args - command line arguments (without the '&' suffix); args[0] is the name of the command
+ * bckgr - background flag
+ * stdinFd - file descriptor to become the standard input of an external command (see makeHereInput()); -1 if there is none
+ *
+ * Returns non-zero if the shell is to exit (the 'exit' built-in command), and 0 otherwise.
+ */
+int executeCommand(char** args, int bckgr, int stdinFd) {
+    unsigned int i; // integer counter; to be used in several places for different reasons
+    processRecord* p;   // to be used in the 'jobs' built-in command
+    schedOptions sched; // scheduling settings parsed by the 'run', 'renice' and 'bgpolicy' built-in commands
+    int optEnd; // index of the first argument after the scheduling options, or -1 if the options were malformed
+    launchOptions opts; // the settings for an external command
+    timeSample selfStart, selfEnd;  // resource usage of the shell, for timing the built-in commands
+
+    initSchedOptions(&opts.sched);
+    opts.stdinFd = stdinFd;
+    opts.timed = TIME_NONE;
+    opts.timeout.set = 0;
+    opts.timeout.timeout = 0;
+    opts.timeout.killAfter = 0;
+    initLimitOptions(&opts.limits);
+
+    // The 'time' prefix: the rest of the command line is executed, and the resources it used are reported
+    while (args[0] != NULL && strcmp(args[0], "time") == 0) {
+        fprintf(stderr, "time is a built-in command\n");
+        opts.timed = TIME_DEFAULT;
+        args++;
+        if (args[0] != NULL && strcmp(args[0], "-p") == 0) {
+            opts.timed = TIME_POSIX;
+            args++;
+        }
+    }
+    if (args[0] == NULL) {
+        printf("time: please specify the command to be timed.\n");
+        return 0;
+    }
+    if (opts.timed) sampleSelf(&selfStart); // In case this is a built-in command
+    context->lastStatus = 0; // Built-in commands succeed unless they say otherwise
+
+    // Process built-in commands...
+    if (strcmp(args[0], "true") == 0 || strcmp(args[0], ":") == 0) { // 'true' and ':' built-in commands: do nothing
+        // (no notice: these are used in loops and conditions)
+    }
+    else if (strcmp(args[0], "false") == 0) { // 'false' built-in command: do nothing, unsuccessfully
+        context->lastStatus = 1;
+    }
+    else if (strcmp(args[0], "help") == 0) { // 'help' built-in command
+        fprintf(stderr, "help is a built-in command\n");
+
+        printHelp();   // Print the Help message 
+    }
+    else if (strcmp(args[0], "cd") == 0) { // 'cd' built-in command
+        fprintf(stderr, "cd is a built-in command\n");
+
+        if (args[1] == NULL || strlen(args[1]) < 1) printf("cd: please specify a proper directory.\n"); // we need the first argument to be present and not empty
+        else {
+            printf("Switching to [%s]...\n", args[1]);
+            if (chdir(args[1]) != 0) {  // try to switch the working directory to the one passed as the first argument
+                context->lastStatus = 1;
+                // Apparently, we have some error
+                if (errno == EACCES) printf("cd: access denied.\n");
+                else if (errno == ENOENT) printf("cd: directory not found.\n");
+                else if (errno == ENOTDIR) printf("cd: the specified path is not a directory.\n");
+                else if (errno == ENAMETOOLONG) printf("cd: the path is too long.\n");
+                else {  // Unexpected error
+                    fprintf(stderr, "\nFATAL ERROR (UNKNOWN): chdir() system call failed. Terminating...\n");
+                    exit(3);
+                }
+            }
+        }
+    }
+    else if (strcmp(args[0], "exit") == 0) { // 'exit' built-in command
+        fprintf(stderr, "exit is a built-in command\n");
+
+        return 1;   // Exit the shell
+    }
+    else if (strcmp(args[0], "jobs") == 0) { // 'jobs' built-in command
+        fprintf(stderr, "jobs is a built-in command\n");
+
+        printf("%d jobs in total.\n\n", nextJobNum - 1);
+        p = procs;
+        // Go through the whole job table printing information about each and every process there
+        for (i = 1; p != NULL; i++) {
+            _printProcInfo(p, i, p->background, p->status, p->exitCode);
+            // If the job has any scheduling settings or resource limits, print them too
+            if (p->sched.cpuList != NULL || p->sched.setNice || p->sched.ioprio >= 0 || hasLimits(&p->limits)) {
+                printf("   ");
+                _printSchedInfo(&p->sched);
+                _printLimitInfo(&p->limits);
+                printf("\n");
+            }
+            if (p->timeoutStage != TIMEOUT_NONE && (p->status == running || p->status == stopped)) {   // The same for the deadline
+                printf("   ");
+                _printTimeoutInfo(p);
+                printf("\n");
+            }
+            if (p->output != NULL) {    // If the output of the job is captured, tell how much of it there is
+                drainCapture(p);
+                printf("   output: %zu bytes captured, %zu not shown", p->output->total, p->output->total - p->output->shown);
+                if (p->output->logPath != NULL) printf("; log: %s", p->output->logPath);
+                printf("\n");
+            }
+            p = p->next;
+        }
+    }
+    else if (strcmp(args[0], "fg") == 0) { // 'fg' built-in command
+        fprintf(stderr, "fg is a built-in command\n");
+
+        // 1) Parse the timeout options; the job number comes after them, and it should not be empty
+        optEnd = parseSchedOptions(args, 1, &opts.sched, &opts.timeout, NULL, "fg");
+        if (optEnd > 0 && (opts.sched.cpuList != NULL || opts.sched.setNice || opts.sched.ioprio >= 0)) {
+            printf("fg: only the --timeout and --kill-after options are accepted (see \"renice\").\n");
+            optEnd = -1;
+        }
+        if (optEnd > 0 && (args[optEnd] == NULL || strlen(args[optEnd]) < 1)) printf("fg: please specify a proper job number.\n");
+        else if (optEnd > 0) {
+            char* firstNonNumber = args[optEnd];
+            unsigned int jN = strtoul(args[optEnd], &firstNonNumber, 0);
+            // 2) Make sure that the job number is a positive integer in the valid range
+            if (jN < 1 || jN >= nextJobNum || *firstNonNumber != '\0') printf("fg: please specify a proper job number.\n");
+            else {
+                // 3) Call resumeProcess() with background flag set to 0
+                resumeProcess(jN, 0, opts.timed, &opts.timeout);
+                opts.timed = TIME_NONE; // already reported
+            }
+        }
+    }
+    else if (strcmp(args[0], "bg") == 0) { // 'bg' built-in command
+        fprintf(stderr, "bg is a built-in command\n");
+
+        // 1) Parse the timeout options; the job number comes after them, and it should not be empty
+        optEnd = parseSchedOptions(args, 1, &opts.sched, &opts.timeout, NULL, "bg");
+        if (optEnd > 0 && (opts.sched.cpuList != NULL || opts.sched.setNice || opts.sched.ioprio >= 0)) {
+            printf("bg: only the --timeout and --kill-after options are accepted (see \"renice\").\n");
+            optEnd = -1;
+        }
+        if (optEnd > 0 && (args[optEnd] == NULL || strlen(args[optEnd]) < 1)) printf("bg: please specify a proper job number.\n");
+        else if (optEnd > 0) {
+            char* firstNonNumber = args[optEnd];
+            unsigned int jN = strtoul(args[optEnd], &firstNonNumber, 0);
+            // 2) Make sure that the job number is a positive integer in the valid range
+            if (jN < 1 || jN >= nextJobNum || *firstNonNumber != '\0') printf("bg: please specify a proper job number.\n");
+            else {
+                // 3) Call resumeProcess() with background flag set to 1
+                resumeProcess(jN, 1, TIME_NONE, &opts.timeout);
+            }
+        }
+    }
+    else if (strcmp(args[0], "run") == 0) { // 'run' built-in command
+        fprintf(stderr, "run is a built-in command\n");
+
+        // 1) Parse the scheduling options
+        optEnd = parseSchedOptions(args, 1, &opts.sched, &opts.timeout, &opts.limits, "run");
+        // 2) Make sure the command itself is present
+        if (optEnd > 0 && args[optEnd] == NULL) printf("run: please specify the command to run.\n");
+        // 3) Launch the command with the requested settings
+        else if (optEnd > 0) executeExternal(args + optEnd, bckgr, &opts);
+    }
+    else if (strcmp(args[0], "renice") == 0) { // 'renice' built-in command
+        fprintf(stderr, "renice is a built-in command\n");
+
+        // 1) Make sure we have the 1st argument not empty
+        if (args[1] == NULL || strlen(args[1]) < 1) printf("renice: please specify a proper job number.\n");
+        else {
+            char* firstNonNumber = args[1];
+            unsigned int jN = strtoul(args[1], &firstNonNumber, 0);
+            // 2) Make sure that the first argument is a positive integer in the valid range
+            if (jN < 1 || jN >= nextJobNum || *firstNonNumber != '\0') printf("renice: please specify a proper job number.\n");
+            else {
+                // 3) Parse the settings and apply them to the job
+                initSchedOptions(&sched);
+                optEnd = parseSchedOptions(args, 2, &sched, NULL, NULL, "renice");
+                if (optEnd > 0 && args[optEnd] != NULL) printf("renice: unexpected argument [%s].\n", args[optEnd]);
+                else if (optEnd > 0) reniceProcess(jN, &sched);
+                freeSchedOptions(&sched);
+            }
+        }
+    }
+    else if (strcmp(args[0], "bgpolicy") == 0) { // 'bgpolicy' built-in command
+        fprintf(stderr, "bgpolicy is a built-in command\n");
+
+        if (args[1] != NULL && strcmp(args[1], "off") == 0 && args[2] == NULL) {
+            bgPolicyOn = 0;
+            freeSchedOptions(&bgPolicy);
+            initSchedOptions(&bgPolicy);
+        }
+        else if (args[1] != NULL) {
+            initSchedOptions(&sched);
+            optEnd = parseSchedOptions(args, 1, &sched, NULL, NULL, "bgpolicy");
+            if (optEnd > 0 && args[optEnd] != NULL) printf("bgpolicy: unexpected argument [%s].\n", args[optEnd]);
+            else if (optEnd > 0) {
+                freeSchedOptions(&bgPolicy);
+                bgPolicy = sched;   // bgPolicy takes over the CPU list
+                bgPolicyOn = 1;
+                initSchedOptions(&sched);
+            }
+            freeSchedOptions(&sched);
+        }
+
+        // In any case, print the current policy
+        if (bgPolicyOn) {
+            printf("Background jobs are started with:");
+            _printSchedInfo(&bgPolicy);
+            printf("\n");
+        }
+        else printf("No background policy is set.\n");
+    }
+    else if (strcmp(args[0], "ulimit") == 0) { // 'ulimit' built-in command
+        fprintf(stderr, "ulimit is a built-in command\n");
+
+        if (args[1] != NULL && strcmp(args[1], "off") == 0 && args[2] == NULL) initLimitOptions(&jobLimits);
+        else if (args[1] != NULL) {
+            limitOptions limits;
+
+            initSchedOptions(&sched);
+            initLimitOptions(&limits);
+            optEnd = parseSchedOptions(args, 1, &sched, NULL, &limits, "ulimit");
+            if (optEnd > 0 && args[optEnd] != NULL) printf("ulimit: unexpected argument [%s].\n", args[optEnd]);
+            else if (optEnd > 0 && (sched.cpuList != NULL || sched.setNice || sched.ioprio >= 0)) {
+                printf("ulimit: only the resource limits can be set; see \"bgpolicy\" for the scheduling settings.\n");
+            }
+            else if (optEnd > 0) {
+                for (i = 0; i < LIMITS; i++) {
+                    if (!limits.set[i]) continue;
+                    jobLimits.set[i] = limits.value[i] != RLIM_INFINITY;  // "unlimited" removes the default
+                    jobLimits.value[i] = limits.value[i];
+                }
+            }
+            freeSchedOptions(&sched);
+        }
+
+        // In any case, print the current limits
+        if (hasLimits(&jobLimits)) {
+            printf("Jobs are started with the limits:");
+            _printLimitInfo(&jobLimits);
+            printf("\n");
+        }
+        else printf("No resource limits are set for the jobs.\n");
+    }
+    else if (strcmp(args[0], "wait") == 0) { // 'wait' built-in command
+        fprintf(stderr, "wait is a built-in command\n");
+
+        int any = 0;    // wait -n: wait for any one of the jobs
+        optEnd = 1;
+        if (args[1] != NULL && strcmp(args[1], "-n") == 0) {
+            any = 1;
+            optEnd = 2;
+        }
+
+        // Count the job numbers
+        i = optEnd;
+        while (args[i] != NULL) i++;
+
+        if (i == (unsigned int) optEnd) waitJobs(NULL, 0, any);   // No job numbers: wait for all the jobs
+        else {
+            unsigned int* jobs = (unsigned int*) malloc((i - optEnd) * sizeof(unsigned int));
+            if (!jobs) {
+                fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+                exit(2);
+            }
+
+            // Make sure that all the arguments are positive integers in the valid range
+            for (i = optEnd; args[i] != NULL; i++) {
+                char* firstNonNumber = args[i];
+                jobs[i - optEnd] = strtoul(args[i], &firstNonNumber, 0);
+                if (strlen(args[i]) < 1 || jobs[i - optEnd] < 1 || jobs[i - optEnd] >= nextJobNum || *firstNonNumber != '\0') break;
+            }
+
+            if (args[i] != NULL) printf("wait: please specify proper job numbers.\n");
+            else waitJobs(jobs, i - optEnd, any);
+            free(jobs);
+        }
+    }
+    else if (strcmp(args[0], "capture") == 0) { // 'capture' built-in command
+        fprintf(stderr, "capture is a built-in command\n");
+
+        if (args[1] != NULL && strcmp(args[1], "on") == 0 && (args[2] == NULL || (strcmp(args[2], "--log") == 0 && args[3] == NULL))) {
+            captureOn = 1;
+            captureLog = args[2] != NULL;
+        }
+        else if (args[1] != NULL && strcmp(args[1], "off") == 0 && args[2] == NULL) {
+            captureOn = 0;
+            captureLog = 0;
+        }
+        else if (args[1] != NULL) printf("capture: please specify \"on\", \"on --log\" or \"off\".\n");
+
+        // In any case, print the current mode
+        if (captureOn) printf("The output of background jobs is captured%s.\n", captureLog ? " and logged" : "");
+        else printf("The output of background jobs is not captured.\n");
+    }
+    else if (strcmp(args[0], "output") == 0) { // 'output' built-in command
+        fprintf(stderr, "output is a built-in command\n");
+
+        unsigned long tail = 0; // --tail: number of the last lines to show
+        int follow = 0; // --follow: keep showing the output as it comes
+        unsigned int jN = 0;
+        char* firstNonNumber;
+
+        // 1) Parse the arguments: the job number and the options, in any order
+        for (i = 1; args[i] != NULL; i++) {
+            firstNonNumber = args[i];
+            if (strcmp(args[i], "--follow") == 0) follow = 1;
+            else if (strcmp(args[i], "--tail") == 0 && args[i + 1] != NULL) {
+                firstNonNumber = args[++i];
+                tail = strtoul(args[i], &firstNonNumber, 10);
+                if (tail < 1 || *firstNonNumber != '\0') break;
+            }
+            else if (jN == 0) {
+                jN = strtoul(args[i], &firstNonNumber, 0);
+                if (jN < 1 || jN >= nextJobNum || *firstNonNumber != '\0') break;
+            }
+            else break;
+        }
+
+        // 2) Make sure that the job number is in the valid range
+        if (args[i] != NULL || jN < 1 || jN >= nextJobNum) printf("output: please specify a proper job number and options.\n");
+        else {
+            p = procs;
+            for (i = 1; i < jN; i++) p = p->next;
+
+            if (p->output == NULL) printf("output: the output of job %u is not captured.\n", jN);
+            else {
+                // 3) Show what has been captured so far...
+                showOutput(p, tail);
+
+                // 4) ...and the rest, as it comes, until the job closes its output or Ctrl-C is pressed
+                if (follow) {
+                    struct sigaction sa, oldsa;
+                    sa.sa_handler = waitInterrupted;
+                    sigemptyset(&sa.sa_mask);
+                    sa.sa_flags = 0;
+                    sigaction(SIGINT, &sa, &oldsa);
+                    waitWasInterrupted = 0;
+                    while (p->outFd >= 0 && pollWithCapture(NULL, 0) >= 0) writeOutput(p->output, p->output->shown);
+                    writeOutput(p->output, p->output->shown);
+                    sigaction(SIGINT, &oldsa, NULL);
+                }
+
+                // 5) A finished job has been kept only for its output
+                if (p->status != running && p->status != stopped && p->statusSlot == STATUS_SLOT_NONE) removeProcess(p);
+            }
+        }
+    }
+    else executeExternal(args, bckgr, &opts);   // Process external commands
+
+    // If the timing was not taken over by a job (i.e. this was a built-in command, or the command failed to launch), report the shell's own usage
+    if (opts.timed) {
+        sampleSelf(&selfEnd);
+        printTimeReport(&selfStart, &selfEnd, opts.timed);
+    }
+
+    freeSchedOptions(&opts.sched);
+
+    return 0;
+}
+
+/*
+ * ==== Control flow (if, while, for) and shell variables ====
+ *
+ * A command line may consist of several commands separated with ';', and it may continue on the following lines (at the prompt,
+ * they are read with the "> " prompt) until all of its constructs are closed:
+ *   if list; then list; [elif list; then list;]... [else list;] fi
+ *   while list; do list; done
+ *   for name in word...; do list; done
+ * The commands are tokenized with strsplit() as usual, and the whole command line is parsed once into a tree of shellNode items,
+ * which is then executed as many times as the loops require; only the words containing '$' are looked at again.
+ * The exit status of a list is the exit status of its last command ($?); an external command succeeds if it exits with 0, and it
+ * counts as 128+N if it was killed by the signal N. If a command is interrupted with Ctrl-C, the rest of the command line is skipped.
+ *
+ * Shell variables are set with 'name=value' (a command consisting only of such assignments). $name, ${name}, $? and $$ are
+ * substituted in all the words; a variable which is not set is looked up in the environment. A value is substituted as one word,
+ * except in the word list of 'for', where it is split at whitespace. '\$' stands for a literal '$' (at the prompt, strsplit() takes
+ * one backslash, so it is typed as '\\$').
+ * Built-in commands never fork, so a loop of built-in commands runs entirely inside the shell; 'true', 'false', ':', 'let' and
+ * the assignments don't even print the usual notice.
+ */
+
+// shellVar - a struct type for the shell variables (a hash table with chaining)
+typedef struct shellVar {
+    char* name;
+    char* value;
+    struct shellVar* next;
+} shellVar;
+
+// simpleCommand - a struct type for one command of a command line, as tokenized by strsplit()
+typedef struct simpleCommand {
+    char** args;    // the words (NULL-terminated; the '&' suffix and the here-document/here-string are already removed)
+    int background; // background flag
+    const char* hereBody;   // body of the here-document/here-string; NULL if there is none
+    size_t hereLength;  // length of the body
+    unsigned int line;  // line number in the script (0 at the prompt)
+} simpleCommand;
+
+// commandList - a struct type for all the commands of a command line (or of a script), in order
+typedef struct commandList {
+    simpleCommand* cmds;
+    unsigned int count, cap;
+    void** buffers; // memory which belongs to the list: the lines, the arrays of words and the here-document bodies
+    unsigned int nbuffers, buffersCap;
+} commandList;
+
+typedef enum nodeType {
+    NODE_COMMAND, NODE_IF, NODE_WHILE, NODE_FOR
+} nodeType;
+
+// shellNode - a struct type for the nodes of the parsed command line; the nodes of a list are linked with 'next'
+typedef struct shellNode {
+    nodeType type;
+    simpleCommand* cmd; // NODE_COMMAND: the command
+    char** args;    // NODE_COMMAND: the words of the command (they may start after a keyword); NODE_FOR: the word list
+    char* var;  // NODE_FOR: name of the loop variable
+    int expand; // non-zero if some of the words contain '$'; otherwise, they are used as they are
+    struct shellNode* cond; // NODE_IF, NODE_WHILE: the condition list
+    struct shellNode* body; // NODE_IF: the 'then' list; NODE_WHILE, NODE_FOR: the loop body
+    struct shellNode* alt;  // NODE_IF: the 'else' list ('elif' is a nested NODE_IF); NULL if there is none
+    struct shellNode* next;
+} shellNode;
+
+// Results of parseCommandList()
+#define PARSE_OK 0
+#define PARSE_INCOMPLETE 1  // the command line ended inside a construct: more lines are needed
+#define PARSE_ERROR 2   // syntax error (the message is printed)
+
+// parseState - a struct type for the position of the parser in the command list
+typedef struct parseState {
+    commandList* list;
+    unsigned int pos;   // current command
+    unsigned int word;  // current word of the current command
+    int result; // PARSE_...
+} parseState;
+
+// Results of runNodes()
+#define RUN_OK 0
+#define RUN_EXIT 1  // the 'exit' built-in command was executed
+#define RUN_INTERRUPTED 2   // a foreground job was interrupted with Ctrl-C
+
+// The words which have a special meaning at the beginning of a command
+const char* shellKeywords[] = {"if", "then", "elif", "else", "fi", "while", "do", "done", "for", NULL};
+
+// _varHash() - the hash table bucket of the variable
+unsigned int _varHash(const char* name, size_t len) {
+    unsigned int h = 5381;
+
+    while (len-- > 0) h = h * 33 + (unsigned char) *name++;
+    return h % VAR_BUCKETS;
+}
+
+/*
+ * getVariable() - returns the value of the variable (the first 'len' characters of 'name'): the shell variable, or the environment
+ * variable if there is no such shell variable; NULL if neither is set
+ */
+const char* getVariable(const char* name, size_t len) {
+    shellVar* v;
+    char buf[256];
+
+    for (v = context->vars[_varHash(name, len)]; v != NULL; v = v->next) {
+        if (strncmp(v->name, name, len) == 0 && v->name[len] == '\0') return v->value;
+    }
+    if (len >= sizeof(buf)) return NULL;
+    memcpy(buf, name, len);
+    buf[len] = '\0';
+    return getenv(buf);
+}
+
+// setVariable() - sets the shell variable
+void setVariable(const char* name, size_t len, const char* value) {
+    shellVar* v;
+    char* copy = (char*) malloc(strlen(value) + 1);
+    unsigned int h = _varHash(name, len);
+
+    if (!copy) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+    strcpy(copy, value);
+
+    for (v = context->vars[h]; v != NULL; v = v->next) {
+        if (strncmp(v->name, name, len) == 0 && v->name[len] == '\0') {
+            free(v->value);
+            v->value = copy;
+            return;
+        }
+    }
+
+    v = (shellVar*) malloc(sizeof(shellVar));
+    if (v) v->name = (char*) malloc(len + 1);
+    if (!v || !v->name) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+    memcpy(v->name, name, len);
+    v->name[len] = '\0';
+    v->value = copy;
+    v->next = context->vars[h];
+    context->vars[h] = v;
+}
+
+// freeVariables() - removes all the shell variables of the context
+void freeVariables(shellContext* c) {
+    shellVar* v;
+    unsigned int i;
+
+    for (i = 0; i < VAR_BUCKETS; i++) {
+        while ((v = c->vars[i]) != NULL) {
+            c->vars[i] = v->next;
+            free(v->name);
+            free(v->value);
+            free(v);
+        }
+    }
+}
+
+// _nameLength() - the length of the variable name at the beginning of the string (0 if it doesn't start with a name)
+size_t _nameLength(const char* str) {
+    size_t len = 0;
+
+    if (!(str[0] == '_' || (str[0] >= 'a' && str[0] <= 'z') || (str[0] >= 'A' && str[0] <= 'Z'))) return 0;
+    while (str[len] == '_' || (str[len] >= 'a' && str[len] <= 'z') || (str[len] >= 'A' && str[len] <= 'Z')
+            || (str[len] >= '0' && str[len] <= '9')) len++;
+    return len;
+}
+
+// isAssignment() - returns non-zero if the word is a variable assignment ('name=value')
+int isAssignment(const char* word) {
+    size_t len = _nameLength(word);
+    return len > 0 && word[len] == '=';
+}
+
+// _appendText() - appends 'len' characters to a growing string
+void _appendText(char** str, size_t* size, size_t* cap, const char* text, size_t len) {
+    if (*size + len + 1 > *cap) {
+        while (*size + len + 1 > *cap) *cap = *cap ? *cap * 2 : 64;
+        *str = (char*) realloc(*str, *cap);
+        if (!*str) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+    }
+    memcpy(*str + *size, text, len);
+    *size += len;
+    (*str)[*size] = '\0';
+}
+
+/*
+ * ==== Arithmetic expansion ====
+ *
+ * $(( expression )) is substituted with the value of the expression, and 'let expression...' evaluates the expressions for their
+ * side effects (its exit status is 0 if the last value is not 0, as in bash). The arithmetic is done inside the shell, with 64-bit
+ * signed integers (wrapping around on overflow); the operators are those of C, with their C precedence, plus '**' (power):
+ *   ( )   ++ -- (postfix and prefix)   + - ! ~ (unary)   **   * / %   + -   << >>   < <= > >=   == !=   &   ^   |   &&   ||   ?:
+ *   = += -= *= /= %= <<= >>= &= ^= |=   ,
+ * Numbers are decimal, octal (0755) or hexadecimal (0xff). A variable is used by its name (or as $name, ${name}); its value is
+ * evaluated as an expression too, and an empty/unset variable counts as 0. $? and $$ are the same as elsewhere.
+ *
+ * An expression is parsed (precedence climbing) into a small tree only once: the trees are kept in a hash table keyed by the text,
+ * so a loop evaluates the same tree every time, and the variables are read when the tree is evaluated, not substituted into the
+ * text. strsplit() splits '$(( i + 1 ))' at the spaces, so the words are joined back by joinArithmetic() when a line is tokenized.
+ */
+
+#define ARITH_BUCKETS 256   // Size of the hash table of the parsed expressions
+#define ARITH_CACHE_MAX 4096    // When the table holds this many expressions, it is emptied (only an endless stream of new ones gets there)
+#define ARITH_MAX_DEPTH 64  // Maximum nesting of the parentheses/operators, and of the variables whose values are expressions
+
+// Operators of the expressions; arithOpNames[] has the same order, the longest operators first (the lexer takes the first match)
+typedef enum arithOp {
+    OP_SHL_ASSIGN, OP_SHR_ASSIGN, OP_ADD_ASSIGN, OP_SUB_ASSIGN, OP_MUL_ASSIGN, OP_DIV_ASSIGN, OP_MOD_ASSIGN, OP_AND_ASSIGN,
+    OP_XOR_ASSIGN, OP_OR_ASSIGN, OP_POW, OP_INC, OP_DEC, OP_SHL, OP_SHR, OP_LE, OP_GE, OP_EQ, OP_NE, OP_LAND, OP_LOR,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_LT, OP_GT, OP_AND, OP_XOR, OP_OR, OP_NOT, OP_BITNOT, OP_QUESTION, OP_COLON,
+    OP_ASSIGN, OP_LPAREN, OP_RPAREN, OP_COMMA, OP_NONE
+} arithOp;
+
+const char* arithOpNames[] = {"<<=", ">>=", "+=", "-=", "*=", "/=", "%=", "&=", "^=", "|=", "**", "++", "--", "<<", ">>", "<=", ">=",
+    "==", "!=", "&&", "||", "+", "-", "*", "/", "%", "<", ">", "&", "^", "|", "!", "~", "?", ":", "=", "(", ")", ",", NULL};
+
+// Types of the nodes of a parsed expression
+typedef enum arithNodeType {
+    ARITH_NUMBER, ARITH_VARIABLE, ARITH_STATUS, ARITH_PID,  // $? and $$
+    ARITH_UNARY,    // 'op' is OP_ADD, OP_SUB, OP_NOT or OP_BITNOT
+    ARITH_BINARY,   // any binary operator except the ones below
+    ARITH_LAND, ARITH_LOR, ARITH_CONDITIONAL, ARITH_COMMA,
+    ARITH_ASSIGN,   // 'op' is OP_ASSIGN or the compound assignment
+    ARITH_PREFIX, ARITH_POSTFIX // 'op' is OP_INC or OP_DEC
+} arithNodeType;
+
+// arithNode - a struct type for a node of a parsed expression; the nodes refer to each other by their indices in the array
+typedef struct arithNode {
+    arithNodeType type;
+    arithOp op;
+    int64_t value;  // ARITH_NUMBER: the number
+    const char* name;   // ARITH_VARIABLE and the nodes which change a variable: the name (in the text of the expression)
+    size_t nameLen;
+    int a, b, c;    // operands
+} arithNode;
+
+// arithExpr - a struct type for a parsed expression (an entry of the hash table)
+typedef struct arithExpr {
+    char* text;
+    arithNode* nodes;
+    unsigned int count, cap;
+    int root;
+    struct arithExpr* next;
+} arithExpr;
+
+arithExpr* arithCache[ARITH_BUCKETS];
+unsigned int arithCached = 0;   // Number of the expressions in the hash table
+int arithEvaluating = 0;    // Non-zero while an expression is evaluated (the hash table cannot be emptied then)
+
+// arithParser - a struct type for the state of the parser of an expression
+typedef struct arithParser {
+    arithExpr* e;
+    const char* pos;
+    const char* error;  // the first error; NULL if there is none
+    int depth;
+} arithParser;
+
+// _freeArithExpr() - frees a parsed expression
+void _freeArithExpr(arithExpr* e) {
+    free(e->text);
+    free(e->nodes);
+    free(e);
+}
+
+// _arithNode() - appends a node to the expression; returns its index
+int _arithNode(arithExpr* e, arithNodeType type, arithOp op, int a, int b, int c) {
+    if (e->count == e->cap) {
+        e->cap = e->cap ? e->cap * 2 : 16;
+        e->nodes = (arithNode*) realloc(e->nodes, e->cap * sizeof(arithNode));
+        if (!e->nodes) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+    }
+    memset(&e->nodes[e->count], 0, sizeof(arithNode));
+    e->nodes[e->count].type = type;
+    e->nodes[e->count].op = op;
+    e->nodes[e->count].a = a;
+    e->nodes[e->count].b = b;
+    e->nodes[e->count].c = c;
+    return e->count++;
+}
+
+// _arithPeek() - returns the operator the parser is at (after the whitespace), or OP_NONE
+arithOp _arithPeek(arithParser* p) {
+    int i;
+
+    p->pos += strspn(p->pos, " \t\n");
+    for (i = 0; arithOpNames[i] != NULL; i++) if (strncmp(p->pos, arithOpNames[i], strlen(arithOpNames[i])) == 0) return (arithOp) i;
+    return OP_NONE;
+}
+
+// _arithFail() - records the error (the first one only); returns -1, which stands for "no node"
+int _arithFail(arithParser* p, const char* error) {
+    if (p->error == NULL) p->error = error;
+    return -1;
+}
+
+/*
+ * _parseArithNumber() - parses a number (decimal, octal with a leading 0, or hexadecimal with 0x) at the beginning of the string
+ * Returns the number of characters taken (0 if the string doesn't start with a digit, or the number is malformed).
+ */
+size_t _parseArithNumber(const char* str, int64_t* value) {
+    uint64_t n = 0;
+    unsigned int base = 10, digit;
+    size_t i = 0;
+
+    if (str[0] < '0' || str[0] > '9') return 0;
+    if (str[0] == '0' && (str[1] == 'x' || str[1] == 'X')) {
+        base = 16;
+        i = 2;
+    }
+    else if (str[0] == '0') base = 8;
+
+    for (;; i++) {
+        if (str[i] >= '0' && str[i] <= '9') digit = str[i] - '0';
+        else if (str[i] >= 'a' && str[i] <= 'z') digit = str[i] - 'a' + 10;
+        else if (str[i] >= 'A' && str[i] <= 'Z') digit = str[i] - 'A' + 10;
+        else break;
+        if (digit >= base) return 0;
+        n = n * base + digit;
+    }
+    if (base == 16 && i == 2) return 0;
+    *value = (int64_t) n;
+    return i;
+}
+
+int _parseArithAssign(arithParser* p);
+
+// _parseArithComma() - parses a list of expressions separated with ','
+int _parseArithComma(arithParser* p) {
+    int left = _parseArithAssign(p), right;
+
+    while (left >= 0 && _arithPeek(p) == OP_COMMA) {
+        p->pos++;
+        if ((right = _parseArithAssign(p)) < 0) return -1;
+        left = _arithNode(p->e, ARITH_COMMA, OP_COMMA, left, right, -1);
+    }
+    return left;
+}
+
+// _parseArithPrimary() - parses a number, $? or $$, or a variable with an optional postfix '++'/'--'
+int _parseArithPrimary(arithParser* p) {
+    int64_t value;
+    size_t len;
+    int n, braces;
+    const char* name;
+    arithOp op;
+
+    if ((len = _parseArithNumber(p->pos, &value)) > 0) {
+        p->pos += len;
+        n = _arithNode(p->e, ARITH_NUMBER, OP_NONE, -1, -1, -1);
+        p->e->nodes[n].value = value;
+        return n;
+    }
+    if (p->pos[0] == '$' && (p->pos[1] == '?' || p->pos[1] == '$')) {
+        p->pos += 2;
+        return _arithNode(p->e, p->pos[-1] == '?' ? ARITH_STATUS : ARITH_PID, OP_NONE, -1, -1, -1);
+    }
+
+    // name, $name or ${name}
+    braces = p->pos[0] == '$' && p->pos[1] == '{';
+    name = p->pos + (p->pos[0] == '$') + braces;
+    if ((len = _nameLength(name)) == 0 || (braces && name[len] != '}')) {
+        return _arithFail(p, p->pos[0] == '\0' || p->pos[0] == ')' ? "operand expected" : "syntax error");
+    }
+    n = _arithNode(p->e, ARITH_VARIABLE, OP_NONE, -1, -1, -1);
+    p->e->nodes[n].name = name;
+    p->e->nodes[n].nameLen = len;
+    p->pos = name + len + braces;
+
+    op = _arithPeek(p);
+    if (op == OP_INC || op == OP_DEC) { // name++, name--
+        p->pos += 2;
+        n = _arithNode(p->e, ARITH_POSTFIX, op, n, -1, -1);
+    }
+    return n;
+}
+
+// _parseArithOperand() - parses a primary expression, a parenthesized expression, or a prefix/unary operator with its operand
+int _parseArithOperand(arithParser* p) {
+    arithOp op = _arithPeek(p);
+    int n;
+
+    if (++p->depth > ARITH_MAX_DEPTH) return _arithFail(p, "expression nested too deeply");
+    if (op == OP_INC || op == OP_DEC) { // ++name, --name
+        p->pos += 2;
+        if ((n = _parseArithOperand(p)) < 0) return -1;
+        if (p->e->nodes[n].type != ARITH_VARIABLE) return _arithFail(p, "++ or -- applied to a non-variable");
+        n = _arithNode(p->e, ARITH_PREFIX, op, n, -1, -1);
+    }
+    else if (op == OP_ADD || op == OP_SUB || op == OP_NOT || op == OP_BITNOT) {
+        p->pos++;
+        if ((n = _parseArithOperand(p)) < 0) return -1;
+        n = _arithNode(p->e, ARITH_UNARY, op, n, -1, -1);
+    }
+    else if (op == OP_LPAREN) {
+        p->pos++;
+        if ((n = _parseArithComma(p)) < 0) return -1;
+        if (_arithPeek(p) != OP_RPAREN) return _arithFail(p, "')' expected");
+        p->pos++;
+    }
+    else if ((n = _parseArithPrimary(p)) < 0) return -1;
+    p->depth--;
+    return n;
+}
+
+// _arithPrecedence() - returns the precedence of the binary operator (higher binds tighter), or 0 if it is not a binary operator
+int _arithPrecedence(arithOp op) {
+    switch (op) {
+    case OP_LOR: return 1;
+    case OP_LAND: return 2;
+    case OP_OR: return 3;
+    case OP_XOR: return 4;
+    case OP_AND: return 5;
+    case OP_EQ: case OP_NE: return 6;
+    case OP_LT: case OP_LE: case OP_GT: case OP_GE: return 7;
+    case OP_SHL: case OP_SHR: return 8;
+    case OP_ADD: case OP_SUB: return 9;
+    case OP_MUL: case OP_DIV: case OP_MOD: return 10;
+    case OP_POW: return 11;
+    default: return 0;
+    }
+}
+
+/*
+ * _parseArithBinary() - parses the binary operators of at least the given precedence (precedence climbing)
+ * All the binary operators are left-associative except '**'.
+ */
+int _parseArithBinary(arithParser* p, int minPrecedence) {
+    int left = _parseArithOperand(p), right, prec;
+    arithOp op;
+    arithNodeType type;
+
+    while (left >= 0 && (prec = _arithPrecedence(op = _arithPeek(p))) >= minPrecedence && prec > 0) {
+        p->pos += strlen(arithOpNames[op]);
+        if ((right = _parseArithBinary(p, op == OP_POW ? prec : prec + 1)) < 0) return -1;
+        type = op == OP_LAND ? ARITH_LAND : op == OP_LOR ? ARITH_LOR : ARITH_BINARY;
+        left = _arithNode(p->e, type, op, left, right, -1);
+    }
+    return left;
+}
+
+// _parseArithConditional() - parses 'condition ? expression : expression'
+int _parseArithConditional(arithParser* p) {
+    int cond = _parseArithBinary(p, 1), a, b;
+
+    if (cond < 0 || _arithPeek(p) != OP_QUESTION) return cond;
+    p->pos++;
+    if ((a = _parseArithComma(p)) < 0) return -1;
+    if (_arithPeek(p) != OP_COLON) return _arithFail(p, "':' expected");
+    p->pos++;
+    if ((b = _parseArithConditional(p)) < 0) return -1;
+    return _arithNode(p->e, ARITH_CONDITIONAL, OP_QUESTION, cond, a, b);
+}
+
+// _parseArithAssign() - parses an assignment (right-associative), or just a conditional expression
+int _parseArithAssign(arithParser* p) {
+    int left = _parseArithConditional(p), right;
+    arithOp op;
+
+    if (left < 0) return -1;
+    op = _arithPeek(p);
+    if (op != OP_ASSIGN && !(op >= OP_SHL_ASSIGN && op <= OP_OR_ASSIGN)) return left;
+    if (p->e->nodes[left].type != ARITH_VARIABLE) return _arithFail(p, "assignment to a non-variable");
+    p->pos += strlen(arithOpNames[op]);
+    if ((right = _parseArithAssign(p)) < 0) return -1;
+    return _arithNode(p->e, ARITH_ASSIGN, op, left, right, -1);
+}
+
+/*
+ * _compileArith() - returns the parsed expression with the given text (the first 'len' characters), parsing it if it isn't
+ * in the hash table yet; NULL if the expression is malformed (the message is printed)
+ */
+arithExpr* _compileArith(const char* text, size_t len) {
+    unsigned int h = 5381, i;
+    size_t k;
+    arithExpr* e;
+    arithParser p;
+
+    for (k = 0; k < len; k++) h = h * 33 + (unsigned char) text[k];
+    h %= ARITH_BUCKETS;
+    for (e = arithCache[h]; e != NULL; e = e->next) if (strncmp(e->text, text, len) == 0 && e->text[len] == '\0') return e;
+
+    e = (arithExpr*) calloc(1, sizeof(arithExpr));
+    if (e) e->text = (char*) malloc(len + 1);
+    if (!e || !e->text) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+    memcpy(e->text, text, len);
+    e->text[len] = '\0';
+
+    // The names of the variables point into e->text
+    p.e = e;
+    p.pos = e->text;
+    p.error = NULL;
+    p.depth = 0;
+    _arithPeek(&p);
+    if (*p.pos == '\0') e->root = _arithNode(e, ARITH_NUMBER, OP_NONE, -1, -1, -1);   // An empty expression is 0
+    else if ((e->root = _parseArithComma(&p)) >= 0) {
+        _arithPeek(&p);
+        if (*p.pos != '\0') _arithFail(&p, "syntax error");
+    }
+    if (p.error != NULL) {
+        printf("Arithmetic error: %s in [%s].\n", p.error, e->text);
+        _freeArithExpr(e);
+        return NULL;
+    }
+
+    if (arithCached >= ARITH_CACHE_MAX && !arithEvaluating) {
+        for (i = 0; i < ARITH_BUCKETS; i++) {
+            while (arithCache[i] != NULL) {
+                arithExpr* next = arithCache[i]->next;
+                _freeArithExpr(arithCache[i]);
+                arithCache[i] = next;
+            }
+        }
+        arithCached = 0;
+    }
+    e->next = arithCache[h];
+    arithCache[h] = e;
+    arithCached++;
+    return e;
+}
+
+int evalArith(const char* text, size_t len, int64_t* value, int depth);
+
+// _arithVariable() - the value of the variable: its value is evaluated as an expression; an empty/unset variable is 0
+int _arithVariable(arithNode* n, int64_t* value, int depth) {
+    const char* str = getVariable(n->name, n->nameLen);
+    size_t len;
+
+    *value = 0;
+    if (str == NULL || *str == '\0') return 0;
+    if ((len = _parseArithNumber(str, value)) > 0 && str[len] == '\0') return 0;    // (the usual case)
+    if (str[0] == '-' && (len = _parseArithNumber(str + 1, value)) > 0 && str[len + 1] == '\0') {
+        *value = (int64_t) (0 - (uint64_t) *value);
+        return 0;
+    }
+    if (depth >= ARITH_MAX_DEPTH) {
+        printf("Arithmetic error: variables refer to each other too deeply [%.*s].\n", (int) n->nameLen, n->name);
+        return -1;
+    }
+    return evalArith(str, strlen(str), value, depth + 1);
+}
+
+// _arithBinary() - applies the binary operator (or the operator of a compound assignment) to the values; -1 on division by zero
+int _arithBinary(arithOp op, int64_t a, int64_t b, int64_t* result) {
+    uint64_t p = 1, base = (uint64_t) a;
+
+    switch (op) {
+    case OP_ADD: case OP_ADD_ASSIGN: *result = (int64_t) ((uint64_t) a + (uint64_t) b); break;   // (wrapping around)
+    case OP_SUB: case OP_SUB_ASSIGN: *result = (int64_t) ((uint64_t) a - (uint64_t) b); break;
+    case OP_MUL: case OP_MUL_ASSIGN: *result = (int64_t) ((uint64_t) a * (uint64_t) b); break;
+    case OP_DIV: case OP_DIV_ASSIGN: case OP_MOD: case OP_MOD_ASSIGN:
+        if (b == 0) {
+            printf("Arithmetic error: division by zero.\n");
+            return -1;
+        }
+        if (b == -1) *result = (op == OP_DIV || op == OP_DIV_ASSIGN) ? (int64_t) (0 - (uint64_t) a) : 0;   // (INT64_MIN / -1 overflows)
+        else *result = (op == OP_DIV || op == OP_DIV_ASSIGN) ? a / b : a % b;
+        break;
+    case OP_POW:
+        if (b < 0) {
+            printf("Arithmetic error: negative exponent.\n");
+            return -1;
+        }
+        for (; b > 0; b >>= 1, base *= base) if (b & 1) p *= base;
+        *result = (int64_t) p;
+        break;
+    case OP_SHL: case OP_SHL_ASSIGN: *result = (int64_t) ((uint64_t) a << (b & 63)); break;
+    case OP_SHR: case OP_SHR_ASSIGN: *result = a >> (b & 63); break;
+    case OP_AND: case OP_AND_ASSIGN: *result = a & b; break;
+    case OP_XOR: case OP_XOR_ASSIGN: *result = a ^ b; break;
+    case OP_OR: case OP_OR_ASSIGN: *result = a | b; break;
+    case OP_LT: *result = a < b; break;
+    case OP_LE: *result = a <= b; break;
+    case OP_GT: *result = a > b; break;
+    case OP_GE: *result = a >= b; break;
+    case OP_EQ: *result = a == b; break;
+    case OP_NE: *result = a != b; break;
+    default: *result = b; break;    // OP_ASSIGN
+    }
+    return 0;
+}
+
+// _setArithVariable() - assigns the value to the variable of the node
+void _setArithVariable(arithNode* n, int64_t value) {
+    char num[24];
+
+    sprintf(num, "%lld", (long long) value);
+    setVariable(n->name, n->nameLen, num);
+}
+
+// _evalArithNode() - evaluates a node of the parsed expression; returns 0 on success, -1 on error (the message is printed)
+int _evalArithNode(arithExpr* e, int i, int64_t* value, int depth) {
+    arithNode* n = &e->nodes[i];
+    int64_t a, b;
+
+    switch (n->type) {
+    case ARITH_NUMBER: *value = n->value; return 0;
+    case ARITH_STATUS: *value = context->lastStatus; return 0;
+    case ARITH_PID: *value = getpid(); return 0;
+    case ARITH_VARIABLE: return _arithVariable(n, value, depth);
+
+    case ARITH_UNARY:
+        if (_evalArithNode(e, n->a, &a, depth) != 0) return -1;
+        if (n->op == OP_SUB) *value = (int64_t) (0 - (uint64_t) a);
+        else if (n->op == OP_NOT) *value = !a;
+        else if (n->op == OP_BITNOT) *value = ~a;
+        else *value = a;
+        return 0;
+
+    case ARITH_BINARY:
+        if (_evalArithNode(e, n->a, &a, depth) != 0 || _evalArithNode(e, n->b, &b, depth) != 0) return -1;
+        return _arithBinary(n->op, a, b, value);
+
+    case ARITH_LAND: case ARITH_LOR:    // The right operand is evaluated only if it is needed
+        if (_evalArithNode(e, n->a, &a, depth) != 0) return -1;
+        if ((n->type == ARITH_LAND) == (a == 0)) {
+            *value = a != 0;
+            return 0;
+        }
+        if (_evalArithNode(e, n->b, &b, depth) != 0) return -1;
+        *value = b != 0;
+        return 0;
+
+    case ARITH_CONDITIONAL:
+        if (_evalArithNode(e, n->a, &a, depth) != 0) return -1;
+        return _evalArithNode(e, a != 0 ? n->b : n->c, value, depth);
+
+    case ARITH_COMMA:
+        if (_evalArithNode(e, n->a, &a, depth) != 0) return -1;
+        return _evalArithNode(e, n->b, value, depth);
+
+    case ARITH_ASSIGN:
+        if (_evalArithNode(e, n->b, &b, depth) != 0) return -1;
+        if (n->op != OP_ASSIGN && _arithVariable(&e->nodes[n->a], &a, depth) != 0) return -1;
+        if (_arithBinary(n->op, a, b, value) != 0) return -1;
+        _setArithVariable(&e->nodes[n->a], *value);
+        return 0;
+
+    case ARITH_PREFIX: case ARITH_POSTFIX:
+        if (_arithVariable(&e->nodes[n->a], &a, depth) != 0) return -1;
+        b = (int64_t) ((uint64_t) a + (n->op == OP_INC ? 1 : (uint64_t) -1));
+        _setArithVariable(&e->nodes[n->a], b);
+        *value = n->type == ARITH_PREFIX ? b : a;
+        return 0;
+    }
+    return -1;
+}
+
+/*
+ * evalArith() - evaluates the expression (the first 'len' characters of 'text'); 'depth' is 0, except for the values of variables
+ * Returns 0 on success, and -1 if the expression is malformed or cannot be evaluated (the message is printed).
+ */
+int evalArith(const char* text, size_t len, int64_t* value, int depth) {
+    arithExpr* e = _compileArith(text, len);
+    int result;
+
+    if (e == NULL) return -1;
+    arithEvaluating++;
+    result = _evalArithNode(e, e->root, value, depth);
+    arithEvaluating--;
+    return result;
+}
+
+/*
+ * _arithEnd() - scans the text after '$((' for the matching '))'
+ * Returns the length of the expression (the '))' follows it), or -1 if the parentheses are not closed in the text.
+ */
+long _arithEnd(const char* text) {
+    int depth = 0;
+    long i;
+
+    for (i = 0; text[i] != '\0'; i++) {
+        if (text[i] == '(') depth++;
+        else if (text[i] == ')' && depth > 0) depth--;
+        else if (text[i] == ')' && text[i + 1] == ')') return i;
+    }
+    return -1;
+}
+
+// _arithUnclosed() - returns non-zero if the word has a '$((' whose '))' is not in the word
+int _arithUnclosed(const char* word) {
+    long len;
+
+    while ((word = strstr(word, "$((")) != NULL) {
+        if ((len = _arithEnd(word + 3)) < 0) return 1;
+        word += len + 5;
+    }
+    return 0;
+}
+
+/*
+ * joinArithmetic() - joins back the words of an arithmetic expansion which strsplit() split at the whitespace ('$((', 'i', '+', '1', '))')
+ * The words are moved within the line that strsplit() split, with one space between them, and the array of words is shortened.
+ */
+void joinArithmetic(char** args) {
+    unsigned int i, j, k;
+    size_t len;
+
+    for (i = 0; args[i] != NULL; i++) {
+        for (j = i + 1; args[j] != NULL && _arithUnclosed(args[i]); j++) {
+            len = strlen(args[i]);
+            args[i][len] = ' ';
+            memmove(args[i] + len + 1, args[j], strlen(args[j]) + 1);   // (the words follow each other in the line)
+        }
+        if (j > i + 1) for (k = i + 1; (args[k] = args[j + k - i - 1]) != NULL; k++);
+    }
+}
+
+/*
+ * expandWord() - substitutes the variables and the arithmetic expansions in the word
+ * Returns the result (allocated with malloc()), or NULL if an arithmetic expansion failed (the message is printed).
+ */
+char* expandWord(const char* word) {
+    char* out = NULL;
+    size_t size = 0, cap = 0, len;
+    const char* value;
+    char num[24];
+    int64_t result;
+    long exprLen;
+
+    _appendText(&out, &size, &cap, "", 0);
+    while (*word != '\0') {
+        if (word[0] == '\\' && word[1] == '$') {    // A literal '$'
+            _appendText(&out, &size, &cap, "$", 1);
+            word += 2;
+        }
+        else if (word[0] != '$') {
+            len = strcspn(word + 1, "\\$") + 1;
+            _appendText(&out, &size, &cap, word, len);
+            word += len;
+        }
+        else if (word[1] == '?' || word[1] == '$') {    // $? - the exit status of the last command; $$ - the PID of the shell
+            sprintf(num, "%d", word[1] == '?' ? context->lastStatus : (int) getpid());
+            _appendText(&out, &size, &cap, num, strlen(num));
+            word += 2;
+        }
+        else if (word[1] == '(' && word[2] == '(' && (exprLen = _arithEnd(word + 3)) >= 0) {  // $(( expression ))
+            if (evalArith(word + 3, exprLen, &result, 0) != 0) {
+                free(out);
+                return NULL;
+            }
+            sprintf(num, "%lld", (long long) result);
+            _appendText(&out, &size, &cap, num, strlen(num));
+            word += exprLen + 5;
+        }
+        else if (word[1] == '{' && (len = _nameLength(word + 2)) > 0 && word[2 + len] == '}') { // ${name}
+            if ((value = getVariable(word + 2, len)) != NULL) _appendText(&out, &size, &cap, value, strlen(value));
+            word += len + 3;
+        }
+        else if ((len = _nameLength(word + 1)) > 0) {   // $name
+            if ((value = getVariable(word + 1, len)) != NULL) _appendText(&out, &size, &cap, value, strlen(value));
+            word += len + 1;
+        }
+        else {  // Just a '$'
+            _appendText(&out, &size, &cap, "$", 1);
+            word++;
+        }
+    }
+    return out;
+}
+
+/*
+ * expandArgs() - substitutes the variables and the arithmetic expansions in all the words of a command
+ * Returns a new NULL-terminated array of words allocated with malloc() (see freeArgs()); a word which consisted only of variables
+ * and became empty is dropped. Returns NULL if an arithmetic expansion failed (the message is printed).
+ */
+char** expandArgs(char** words) {
+    unsigned int n, i, j;
+    char** out;
+
+    for (n = 0; words[n] != NULL; n++);
+    out = (char**) malloc((n + 1) * sizeof(char*));
+    if (!out) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+
+    for (i = 0, j = 0; i < n; i++) {
+        if ((out[j] = expandWord(words[i])) == NULL) {
+            while (j > 0) free(out[--j]);
+            free(out);
+            return NULL;
+        }
+        if (out[j][0] == '\0' && words[i][0] == '$') free(out[j]);
+        else j++;
+    }
+    out[j] = NULL;
+    return out;
+}
+
+// freeArgs() - frees an array of words returned by expandArgs()
+void freeArgs(char** args) {
+    unsigned int i;
+
+    for (i = 0; args[i] != NULL; i++) free(args[i]);
+    free(args);
+}
+
+// _hasDollar() - returns non-zero if any of the words contains '$'
+int _hasDollar(char** words) {
+    for (; *words != NULL; words++) if (strchr(*words, '$') != NULL) return 1;
+    return 0;
+}
+
+// initCommandList() - prepares an empty command list
+void initCommandList(commandList* list) {
+    memset(list, 0, sizeof(commandList));
+}
+
+// addListBuffer() - makes the memory block a part of the command list: it is freed together with the list
+void addListBuffer(commandList* list, void* buffer) {
+    if (list->nbuffers >= list->buffersCap) {
+        list->buffersCap = list->buffersCap ? list->buffersCap * 2 : 16;
+        list->buffers = (void**) realloc(list->buffers, list->buffersCap * sizeof(void*));
+        if (!list->buffers) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+    }
+    list->buffers[list->nbuffers++] = buffer;
+}
+
+// addListCommand() - appends a command to the command list
+void addListCommand(commandList* list, char** args, int background, const char* hereBody, size_t hereLength, unsigned int line) {
+    if (list->count >= list->cap) {
+        list->cap = list->cap ? list->cap * 2 : 16;
+        list->cmds = (simpleCommand*) realloc(list->cmds, list->cap * sizeof(simpleCommand));
+        if (!list->cmds) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+    }
+    list->cmds[list->count].args = args;
+    list->cmds[list->count].background = background;
+    list->cmds[list->count].hereBody = hereBody;
+    list->cmds[list->count].hereLength = hereLength;
+    list->cmds[list->count].line = line;
+    list->count++;
+}
+
+// freeCommandList() - frees all the memory of the command list
+void freeCommandList(commandList* list) {
+    unsigned int i;
+
+    for (i = 0; i < list->nbuffers; i++) free(list->buffers[i]);
+    free(list->buffers);
+    free(list->cmds);
+    initCommandList(list);
+}
+
+/*
+ * splitCommands() - splits a line into commands at the ';' characters (except the ones inside double quotes or escaped with '\')
+ * The line is modified in place; returns the NULL-terminated array of the commands (allocated with malloc()).
+ */
+char** splitCommands(char* line) {
+    unsigned int n = 1, cap = 8;
+    char** parts = (char**) malloc(cap * sizeof(char*));
+    int doublequotes = 0;
+
+    if (!parts) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+
+    parts[0] = line;
+    for (; *line != '\0'; line++) {
+        if (*line == '\\' && line[1] != '\0') line++;   // The escaped character is skipped
+        else if (*line == '"') doublequotes = !doublequotes;
+        else if (*line == ';' && !doublequotes) {
+            *line = '\0';
+            if (n + 1 >= cap) {
+                cap *= 2;
+                parts = (char**) realloc(parts, cap * sizeof(char*));
+                if (!parts) {
+                    fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+                    exit(2);
+                }
+            }
+            parts[n++] = line + 1;
+        }
+    }
+    parts[n] = NULL;
+    return parts;
+}
+
+/*
+ * addCommandLine() - tokenizes a line typed at the prompt (or given with -c) and appends its commands to the command list
+ * The commands point into the line, so it must stay until the list is freed. If hereDocs is non-zero, the bodies of the
+ * here-documents are read from the standard input; otherwise, here-documents are not allowed.
+ * Returns 0 on success, -1 if the line is malformed (the message is printed).
+ */
+int addCommandLine(commandList* list, char* line, int hereDocs) {
+    char** pieces;
+    char** args;
+    char** hereOps; // the unquoted here-document/here-string operators of the command (see splitWords())
+    unsigned int i;
+    int bckgr, hereType, result = 0;
+    char* hereWord;
+    char* hereBody;
+    size_t hereLen, hereCap;
+
+    pieces = splitCommands(line);
+
+    for (i = 0; pieces[i] != NULL && result == 0; i++) {
+        args = splitWords(pieces[i], " \t\v\r\n\a", &hereOps);
+        addListBuffer(list, args);
+        joinArithmetic(args);
+        bckgr = stripBackground(args);  // Determine whether the command had the '&' suffix
+        if (args[0] == NULL || strlen(args[0]) < 1 || args[0][0] == '#') {  // Skip empty commands and comments
+            free(hereOps);
+            continue;
+        }
+
+        // Here-documents/here-strings: the body is read right away (it follows the line, so it comes before any continuation lines)
+        hereBody = NULL;
+        hereLen = 0;
+        hereCap = 0;
+        hereType = extractHereInput(args, hereOps, &hereWord);
+        free(hereOps);
+        if (hereType == HERE_ERROR) result = -1;
+        else if (hereType == HERE_STRING) appendHereLine(&hereBody, &hereLen, &hereCap, hereWord, 0);
+        else if (hereType != HERE_NONE && !hereDocs) {
+            printf("Here-documents are not supported here; use <<< instead.\n");
+            result = -1;
+        }
+        else if (hereType != HERE_NONE) hereBody = readHereDoc(hereWord, hereType == HERE_DOC_STRIPTABS, &hereLen);
+
+        if (hereBody != NULL) addListBuffer(list, hereBody);
+        if (result == 0 && args[0] != NULL) addListCommand(list, args, bckgr, hereType == HERE_NONE ? NULL : hereBody, hereLen, 0);
+    }
+
+    free(pieces);
+    return result;
+}
+
+// _currentWord() - returns the word the parser is at (moving to the next command when the current one has no more words); NULL at the end
+char* _currentWord(parseState* s) {
+    while (s->pos < s->list->count && s->list->cmds[s->pos].args[s->word] == NULL) {
+        s->pos++;
+        s->word = 0;
+    }
+    return s->pos < s->list->count ? s->list->cmds[s->pos].args[s->word] : NULL;
+}
+
+// _parseError() - reports a syntax error at the given word (the first error only)
+void _parseError(parseState* s, const char* word) {
+    if (s->result == PARSE_ERROR) return;
+    s->result = PARSE_ERROR;
+    if (word == NULL) printf("Syntax error: unexpected end of the command line");
+    else printf("Syntax error: unexpected [%s]", word);
+    if (s->pos < s->list->count && s->list->cmds[s->pos].line > 0) printf(" (line %u)", s->list->cmds[s->pos].line);
+    printf(".\n");
+}
+
+// _isOneOf() - returns non-zero if the word is one of the words in the NULL-terminated array
+int _isOneOf(const char* word, const char* const* words) {
+    for (; words != NULL && *words != NULL; words++) if (strcmp(word, *words) == 0) return 1;
+    return 0;
+}
+
+/*
+ * _expectKeyword() - consumes the keyword the parser is at
+ * Returns non-zero on success; otherwise, the result of the parsing becomes PARSE_INCOMPLETE (the end of the command line
+ * was reached) or PARSE_ERROR (another word was found).
+ */
+int _expectKeyword(parseState* s, const char* keyword) {
+    char* word;
+
+    if (s->result != PARSE_OK) return 0;
+    word = _currentWord(s);
+    if (word == NULL) {
+        s->result = PARSE_INCOMPLETE;
+        return 0;
+    }
+    if (strcmp(word, keyword) != 0) {
+        _parseError(s, word);
+        return 0;
+    }
+    s->word++;
+    return 1;
+}
+
+// _endOfConstruct() - makes sure that nothing follows the closing keyword ('fi', 'done') in the same command
+void _endOfConstruct(parseState* s) {
+    if (s->result == PARSE_OK && s->list->cmds[s->pos].args[s->word] != NULL) _parseError(s, s->list->cmds[s->pos].args[s->word]);
+}
+
+// _newNode() - allocates a node of the given type
+shellNode* _newNode(nodeType type) {
+    shellNode* n = (shellNode*) calloc(1, sizeof(shellNode));
+
+    if (!n) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+    n->type = type;
+    return n;
+}
+
+// freeNodes() - frees the list of nodes and all of their subtrees
+void freeNodes(shellNode* n) {
+    shellNode* next;
+
+    for (; n != NULL; n = next) {
+        next = n->next;
+        freeNodes(n->cond);
+        freeNodes(n->body);
+        freeNodes(n->alt);
+        free(n);
+    }
+}
+
+shellNode* _parseList(parseState* s, const char* const* terminators);
+
+// _parseNonEmptyList() - the same as _parseList(), but an empty list is a syntax error
+shellNode* _parseNonEmptyList(parseState* s, const char* const* terminators) {
+    shellNode* list = _parseList(s, terminators);
+
+    if (list == NULL && s->result == PARSE_OK) _parseError(s, _currentWord(s));
+    return list;
+}
+
+// _parseIf() - parses the rest of an 'if' (or 'elif') construct, after the keyword, into the node
+void _parseIf(parseState* s, shellNode* n) {
+    static const char* const thenWords[] = {"then", NULL};
+    static const char* const elseWords[] = {"elif", "else", "fi", NULL};
+    static const char* const fiWords[] = {"fi", NULL};
+    char* word;
+
+    n->cond = _parseNonEmptyList(s, thenWords);
+    if (!_expectKeyword(s, "then")) return;
+    n->body = _parseNonEmptyList(s, elseWords);
+    if (s->result != PARSE_OK) return;
+
+    word = _currentWord(s);
+    s->word++;
+    if (strcmp(word, "elif") == 0) {
+        n->alt = _newNode(NODE_IF);
+        _parseIf(s, n->alt);
+    }
+    else {
+        if (strcmp(word, "else") == 0) {
+            n->alt = _parseNonEmptyList(s, fiWords);
+            if (!_expectKeyword(s, "fi")) return;
+        }
+        _endOfConstruct(s);
+    }
+}
+
+// _parseItem() - parses one command or construct
+shellNode* _parseItem(parseState* s) {
+    static const char* const doWords[] = {"do", NULL};
+    static const char* const doneWords[] = {"done", NULL};
+    simpleCommand* cmd = &s->list->cmds[s->pos];
+    char* word = cmd->args[s->word];
+    shellNode* n;
+
+    if (strcmp(word, "if") == 0) {
+        s->word++;
+        n = _newNode(NODE_IF);
+        _parseIf(s, n);
+    }
+    else if (strcmp(word, "while") == 0) {
+        s->word++;
+        n = _newNode(NODE_WHILE);
+        n->cond = _parseNonEmptyList(s, doWords);
+        if (_expectKeyword(s, "do")) {
+            n->body = _parseNonEmptyList(s, doneWords);
+            if (_expectKeyword(s, "done")) _endOfConstruct(s);
+        }
+    }
+    else if (strcmp(word, "for") == 0) {
+        // 'for name in word...' takes the whole command
+        n = _newNode(NODE_FOR);
+        n->var = cmd->args[s->word + 1];
+        if (n->var == NULL || _nameLength(n->var) != strlen(n->var)) _parseError(s, n->var);
+        else if (cmd->args[s->word + 2] == NULL || strcmp(cmd->args[s->word + 2], "in") != 0) _parseError(s, cmd->args[s->word + 2]);
+        else {
+            n->args = cmd->args + s->word + 3;
+            n->expand = _hasDollar(n->args);
+            s->pos++;
+            s->word = 0;
+            if (_expectKeyword(s, "do")) {
+                n->body = _parseNonEmptyList(s, doneWords);
+                if (_expectKeyword(s, "done")) _endOfConstruct(s);
+            }
+        }
+    }
+    else if (_isOneOf(word, shellKeywords)) {   // A keyword out of place
+        _parseError(s, word);
+        return NULL;
+    }
+    else {  // A simple command: the rest of the words
+        n = _newNode(NODE_COMMAND);
+        n->cmd = cmd;
+        n->args = cmd->args + s->word;
+        n->expand = _hasDollar(n->args);
+        s->pos++;
+        s->word = 0;
+    }
+    return n;
+}
+
+// _parseList() - parses the commands and constructs up to one of the terminators (or up to the end, if terminators is NULL)
+shellNode* _parseList(parseState* s, const char* const* terminators) {
+    shellNode* head = NULL;
+    shellNode* tail = NULL;
+    shellNode* n;
+    char* word;
+
+    while (s->result == PARSE_OK) {
+        word = _currentWord(s);
+        if (word == NULL) {
+            if (terminators != NULL) s->result = PARSE_INCOMPLETE;
+            break;
+        }
+        if (_isOneOf(word, terminators)) break;
+
+        if ((n = _parseItem(s)) == NULL) break;
+        if (tail == NULL) head = n;
+        else tail->next = n;
+        tail = n;
+    }
+    return head;
+}
+
+/*
+ * parseCommandList() - parses the command list into a tree
+ * Returns PARSE_OK (the tree is stored in *tree; it's NULL if there are no commands), PARSE_INCOMPLETE or PARSE_ERROR.
+ */
+int parseCommandList(commandList* list, shellNode** tree) {
+    parseState s;
+
+    s.list = list;
+    s.pos = 0;
+    s.word = 0;
+    s.result = PARSE_OK;
+
+    *tree = _parseList(&s, NULL);
+    if (s.result != PARSE_OK) {
+        freeNodes(*tree);
+        *tree = NULL;
+    }
+    return s.result;
+}
+
+/*
+ * runCommandNode() - executes a simple command of the tree
+ * Returns one of the RUN_... values.
+ */
+int runCommandNode(shellNode* n) {
+    char** args;
+    int stdinFd = -1;
+    int exitShell = 0;
+    int64_t value = 0;
+    unsigned int i;
+
+    if (procs != NULL) {    // The same as before every command prompt (there's nothing to do if there are no jobs)
+        updateStatus();
+        flushStatusBuffer();
+    }
+
+    args = n->expand ? expandArgs(n->args) : n->args;
+    if (args == NULL) { // An arithmetic expansion failed: the command is not executed
+        context->lastStatus = 1;
+        return RUN_OK;
+    }
+
+    // A command consisting only of assignments sets the variables
+    for (i = 0; args[i] != NULL && isAssignment(args[i]); i++);
+    if (i > 0 && args[i] == NULL) {
+        for (i = 0; args[i] != NULL; i++) {
+            size_t len = _nameLength(args[i]);
+            setVariable(args[i], len, args[i] + len + 1);
+        }
+        context->lastStatus = 0;
+    }
+    else if (args[0] != NULL && strcmp(args[0], "let") == 0) {  // 'let' built-in command (no notice, just like the assignments)
+        if (args[1] == NULL) printf("let: please specify an expression.\n");
+        for (i = 1; args[i] != NULL && evalArith(args[i], strlen(args[i]), &value, 0) == 0; i++);
+        context->lastStatus = args[1] != NULL && args[i] == NULL && value != 0 ? 0 : 1;
+    }
+    else if (args[0] != NULL) {
+        // The here-document/here-string, if any, is copied into a pipe/memfd every time the command is executed
+        if (n->cmd->hereBody != NULL && (stdinFd = makeHereInput(n->cmd->hereBody, n->cmd->hereLength)) < 0) {
+            printf("Unable to create the here-document: %s.\n", strerror(errno));
+            context->lastStatus = 1;
+        }
+        else exitShell = executeCommand(args, n->cmd->background, stdinFd);
+        if (stdinFd >= 0) close(stdinFd);
+    }
+
+    if (n->expand) freeArgs(args);
+    if (exitShell) return RUN_EXIT;
+    if (context->lastStatus == 128 + SIGINT) return RUN_INTERRUPTED;
+    return RUN_OK;
+}
+
+/*
+ * runNodes() - executes a list of nodes of the tree; context->lastStatus is the exit status of the last executed command
+ * Returns one of the RUN_... values.
+ */
+int runNodes(shellNode* n) {
+    int result = RUN_OK;
+    int status;
+    char** words;
+    char* item;
+    unsigned int i;
+
+    for (; n != NULL && result == RUN_OK; n = n->next) {
+        switch (n->type) {
+        case NODE_COMMAND:
+            result = runCommandNode(n);
+            break;
+
+        case NODE_IF:
+            if ((result = runNodes(n->cond)) != RUN_OK) break;
+            if (context->lastStatus == 0) result = runNodes(n->body);
+            else if (n->alt != NULL) result = runNodes(n->alt);
+            else context->lastStatus = 0;
+            break;
+
+        case NODE_WHILE:
+            status = 0; // exit status of the last command of the body
+            while ((result = runNodes(n->cond)) == RUN_OK && context->lastStatus == 0) {
+                if ((result = runNodes(n->body)) != RUN_OK) break;
+                status = context->lastStatus;
+            }
+            if (result == RUN_OK) context->lastStatus = status;
+            break;
+
+        case NODE_FOR:
+            // The word list is taken once, before the first iteration
+            words = n->expand ? expandArgs(n->args) : n->args;
+            if (words == NULL) {    // An arithmetic expansion failed
+                context->lastStatus = 1;
+                break;
+            }
+            context->lastStatus = 0;
+            for (i = 0; words[i] != NULL && result == RUN_OK; i++) {
+                if (!n->expand || strpbrk(words[i], " \t\n") == NULL) {
+                    setVariable(n->var, strlen(n->var), words[i]);
+                    result = runNodes(n->body);
+                    continue;
+                }
+
+                // A word with a substituted value is split at whitespace: every field is an item
+                char* fields = (char*) malloc(strlen(words[i]) + 1);
+                char* save;
+                if (!fields) {
+                    fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+                    exit(2);
+                }
+                strcpy(fields, words[i]);
+                for (item = strtok_r(fields, " \t\n", &save); item != NULL && result == RUN_OK; item = strtok_r(NULL, " \t\n", &save)) {
+                    setVariable(n->var, strlen(n->var), item);
+                    result = runNodes(n->body);
+                }
+                free(fields);
+            }
+            if (n->expand) freeArgs(words);
+            break;
+        }
+    }
+    return result;
+}
+
+/*
+ * ==== Scripts ====
+ *
+ * A script is a text file with command lines, executed exactly as if they were typed at the command prompt (empty lines and
+ * commands starting with '#' are skipped); the commands of the whole script are parsed together (see "Control flow"), so the
+ * constructs may span many lines. Splitting the lines into commands and tokenizing them with strsplit() is only done the first time
+ * a script is run: the result is saved in a cache file, which is keyed by the identity of the script file (device, inode,
+ * size and modification time). When the same unchanged script is run again, the cache file is simply mapped into memory
+ * with mmap() and the commands are executed directly from there.
+ *
+ * Cache file layout (all the numbers are in the native byte order):
+ * scriptHeader | scriptCommand[ncommands] | uint32_t words[nwords] | char strings[stringsSize]
+ * Each command refers to 'nwords' consecutive entries of 'words' starting at 'firstWord'; each entry of 'words' is the offset of a
+ * '\0'-terminated argument in 'strings'. The bodies of the here-documents/here-strings are also kept in 'strings'.
+ */
+
+#define SCRIPT_CACHE_MAGIC "SSHC"
+#define SCRIPT_CACHE_VERSION 5
+
+typedef struct scriptHeader {
+    char magic[4];  // SCRIPT_CACHE_MAGIC
+    uint32_t version;   // SCRIPT_CACHE_VERSION
+    uint64_t dev;   // identity of the script file the cache was generated from
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    uint32_t ncommands; // number of commands
+    uint32_t nwords;    // total number of arguments in all the commands
+    uint32_t stringsSize;   // size of the strings area, in bytes
+    uint32_t maxWords;  // the largest number of arguments in one command
+} scriptHeader;
+
+typedef struct scriptCommand {
+    uint32_t firstWord; // index of the first argument in 'words'
+    uint32_t nwords;    // number of arguments
+    uint32_t background;    // background flag (the '&' suffix is already removed)
+    uint32_t line;  // line number in the script
+    uint32_t hereInput; // offset of the here-document/here-string body in 'strings' plus 1; 0 if the command has none
+    uint32_t hereLength;    // length of the body
+} scriptCommand;
+
+// scriptImage - a parsed script, either mapped from a cache file or just generated in memory
+typedef struct scriptImage {
+    void* base; // the whole image in the cache file layout
+    size_t length;  // size of the image
+    int mapped; // non-zero if the image is mapped with mmap(); otherwise, it was allocated with malloc()
+    scriptHeader* header;
+    scriptCommand* commands;
+    uint32_t* words;
+    char* strings;
+} scriptImage;
+
+/*
+ * _setScriptPointers() - fills the pointers to different areas of a script image based on its header
+ * Returns 0 if the image is consistent, and -1 if it is not (e.g. a corrupt cache file).
+ */
+int _setScriptPointers(scriptImage* img) {
+    uint32_t i;
+
+    if (img->length < sizeof(scriptHeader)) return -1;
+    img->header = (scriptHeader*) img->base;
+    if (memcmp(img->header->magic, SCRIPT_CACHE_MAGIC, 4) != 0 || img->header->version != SCRIPT_CACHE_VERSION) return -1;
+    if (img->length != sizeof(scriptHeader) + (uint64_t) img->header->ncommands * sizeof(scriptCommand)
+            + (uint64_t) img->header->nwords * sizeof(uint32_t) + img->header->stringsSize) return -1;
+
+    img->commands = (scriptCommand*) (img->header + 1);
+    img->words = (uint32_t*) (img->commands + img->header->ncommands);
+    img->strings = (char*) (img->words + img->header->nwords);
+
+    // Make sure that all the references stay inside the image
+    if (img->header->stringsSize > 0 && img->strings[img->header->stringsSize - 1] != '\0') return -1;
+    for (i = 0; i < img->header->nwords; i++) if (img->words[i] >= img->header->stringsSize) return -1;
+    for (i = 0; i < img->header->ncommands; i++) {
+        if (img->commands[i].nwords > img->header->maxWords
+                || (uint64_t) img->commands[i].firstWord + img->commands[i].nwords > img->header->nwords
+                || (uint64_t) img->commands[i].hereInput + img->commands[i].hereLength > img->header->stringsSize) return -1;
+    }
+    return 0;
+}
+
+/*
+ * _scriptCachePath() - returns the path to the cache file of the script identified by st (allocated with malloc()),
+ * creating the cache directory if necessary. Returns NULL if there is no place for the cache.
+ * The cache directory is $SEASHELL_CACHE_DIR, or $XDG_CACHE_HOME/seashell, or $HOME/.cache/seashell.
+ */
+char* _scriptCachePath(struct stat* st) {
+    char* dir = getenv("SEASHELL_CACHE_DIR");
+    char* base;
+    char* path;
+    const char* suffix = "";
+
+    if (dir == NULL || *dir == '\0') {
+        if ((base = getenv("XDG_CACHE_HOME")) != NULL && *base != '\0') suffix = "/seashell";
+        else if ((base = getenv("HOME")) != NULL && *base != '\0') suffix = "/.cache/seashell";
+        else return NULL;
+    }
+    else base = dir;
+
+    path = (char*) malloc(strlen(base) + strlen(suffix) + 64);
+    if (!path) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+
+    // Create the directory (and its parent, for the default ~/.cache/seashell); it is fine if they already exist
+    strcpy(path, base);
+    if (strcmp(suffix, "/.cache/seashell") == 0) {
+        strcat(path, "/.cache");
+        mkdir(path, S_IRWXU);
+        strcpy(path, base);
+    }
+    strcat(path, suffix);
+    if (mkdir(path, S_IRWXU) != 0 && errno != EEXIST) {
+        free(path);
+        return NULL;
+    }
+
+    sprintf(path + strlen(path), "/script-%llx-%llx", (unsigned long long) st->st_dev, (unsigned long long) st->st_ino);
+    return path;
+}
+
+/*
+ * _appendScriptString() - appends 'len' bytes and a '\0' to the strings area of a script image being generated
+ * Returns the offset of the appended string in the strings area.
+ */
+uint32_t _appendScriptString(char** strings, size_t* cap, uint32_t* size, const char* str, size_t len) {
+    uint32_t offset = *size;
+
+    while (*size + len + 1 > *cap) {
+        *cap = *cap ? *cap * 2 : 4096;
+        *strings = (char*) realloc(*strings, *cap);
+        if (!*strings) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+    }
+    if (len > 0) memcpy(*strings + *size, str, len);
+    (*strings)[*size + len] = '\0';
+    *size += len + 1;
+    return offset;
+}
+
+/*
+ * _parseScript() - tokenizes the script text and generates its image in memory (in the cache file layout)
+ * Arguments:
+ * text - the content of the script file ('\0'-terminated; it is modified in the process)
+ * st - identity of the script file
+ * img - the resulting image
+ */
+void _parseScript(char* text, struct stat* st, scriptImage* img) {
+    scriptHeader header;
+    scriptCommand* commands = NULL;
+    uint32_t* words = NULL;
+    char* strings = NULL;
+    size_t commandsCap = 0, wordsCap = 0, stringsCap = 0;
+    char* line = text;
+    char* eol;
+    char** args;
+    char** hereOps; // the unquoted here-document/here-string operators of the command (see splitWords())
+    char** pieces;  // the commands of the current line
+    unsigned int p;
+    uint32_t lineNum = 0;
+    unsigned int i;
+    int bckgr;
+    int hereType;   // type of the standard input redirection of the command (HERE_...)
+    char* hereWord; // the here-document delimiter or the here-string
+    char* hereBody = NULL;  // body of the here-document/here-string
+    size_t hereLen, hereCap = 0;
+    int found;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SCRIPT_CACHE_MAGIC, 4);
+    header.version = SCRIPT_CACHE_VERSION;
+    header.dev = st->st_dev;
+    header.ino = st->st_ino;
+    header.size = st->st_size;
+    header.mtimeSec = st->st_mtim.tv_sec;
+    header.mtimeNsec = st->st_mtim.tv_nsec;
+
+    while (line != NULL && *line != '\0') {
+        // Cut the next line out of the text
+        lineNum++;
+        eol = strchr(line, '\n');
+        if (eol != NULL) *eol = '\0';
+
+        // Every command of the line (separated with ';') becomes a separate command of the image
+        pieces = splitCommands(line);
+        for (p = 0; pieces[p] != NULL; p++) {
+            args = splitWords(pieces[p], " \t\v\r\n\a", &hereOps);
+            joinArithmetic(args);
+            bckgr = stripBackground(args);
+
+            if (args[0] == NULL || strlen(args[0]) < 1 || args[0][0] == '#') {  // Skip empty commands and comments
+                free(args);
+                free(hereOps);
+                continue;
+            }
+
+            // Here-documents/here-strings: the body becomes a part of the command
+            hereLen = 0;
+            hereType = extractHereInput(args, hereOps, &hereWord);
+            free(hereOps);
+            if (hereType == HERE_STRING) appendHereLine(&hereBody, &hereLen, &hereCap, hereWord, 0);
+            else if (hereType == HERE_DOC || hereType == HERE_DOC_STRIPTABS) {
+                // The body consists of the following lines, up to the delimiter line
+                found = 0;
+                while (eol != NULL) {
+                    line = eol + 1;
+                    lineNum++;
+                    eol = strchr(line, '\n');
+                    if (eol != NULL) *eol = '\0';
+                    else if (*line == '\0') break; // the end of the script
+
+                    if (strcmp(hereType == HERE_DOC_STRIPTABS ? line + strspn(line, "\t") : line, hereWord) == 0) {
+                        found = 1;
+                        break;
+                    }
+                    appendHereLine(&hereBody, &hereLen, &hereCap, line, hereType == HERE_DOC_STRIPTABS);
+                }
+                if (!found) printf("Script line %u: the here-document was ended by the end of file (wanted [%s]).\n", lineNum, hereWord);
+            }
+            else if (hereType == HERE_ERROR) printf("Script line %u: the command is skipped.\n", lineNum);
+
+            if (hereType != HERE_ERROR && args[0] != NULL) {
+                if (header.ncommands >= commandsCap) {
+                    commandsCap = commandsCap ? commandsCap * 2 : 64;
+                    commands = (scriptCommand*) realloc(commands, commandsCap * sizeof(scriptCommand));
+                }
+                for (i = 0; args[i] != NULL; i++);
+                while (header.nwords + i >= wordsCap) {
+                    wordsCap = wordsCap ? wordsCap * 2 : 256;
+                    words = (uint32_t*) realloc(words, wordsCap * sizeof(uint32_t));
+                }
+                if (!commands || !words) {
+                    fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+                    exit(2);
+                }
+
+                commands[header.ncommands].firstWord = header.nwords;
+                commands[header.ncommands].nwords = i;
+                commands[header.ncommands].background = bckgr;
+                commands[header.ncommands].line = lineNum;
+                commands[header.ncommands].hereInput = 0;
+                commands[header.ncommands].hereLength = 0;
+                if (i > header.maxWords) header.maxWords = i;
+
+                // Copy the arguments and the here-document into the strings area
+                for (i = 0; args[i] != NULL; i++) {
+                    words[header.nwords++] = _appendScriptString(&strings, &stringsCap, &header.stringsSize, args[i], strlen(args[i]));
+                }
+                if (hereType != HERE_NONE) {
+                    commands[header.ncommands].hereInput = _appendScriptString(&strings, &stringsCap, &header.stringsSize, hereBody, hereLen) + 1;
+                    commands[header.ncommands].hereLength = hereLen;
+                }
+                header.ncommands++;
+            }
+            free(args);
+        }
+        free(pieces);
+
+        line = eol ? eol + 1 : NULL;
+    }
+    free(hereBody);
+
+    // Pad the strings area, so that the size of the image stays a multiple of 4
+    while (header.stringsSize % 4 != 0) {
+        if (header.stringsSize >= stringsCap) {
+            stringsCap += 4;
+            strings = (char*) realloc(strings, stringsCap);
+            if (!strings) {
+                fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+                exit(2);
+            }
+        }
+        strings[header.stringsSize++] = '\0';
+    }
+
+    // Put all the parts together
+    img->length = sizeof(scriptHeader) + header.ncommands * sizeof(scriptCommand) + header.nwords * sizeof(uint32_t) + header.stringsSize;
+    img->base = malloc(img->length);
+    img->mapped = 0;
+    if (!img->base) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+    memcpy(img->base, &header, sizeof(header));
+    img->header = (scriptHeader*) img->base;
+    img->commands = (scriptCommand*) (img->header + 1);
+    img->words = (uint32_t*) (img->commands + header.ncommands);
+    img->strings = (char*) (img->words + header.nwords);
+    if (header.ncommands) memcpy(img->commands, commands, header.ncommands * sizeof(scriptCommand));
+    if (header.nwords) memcpy(img->words, words, header.nwords * sizeof(uint32_t));
+    if (header.stringsSize) memcpy(img->strings, strings, header.stringsSize);
+
+    free(commands);
+    free(words);
+    free(strings);
+}
+
+/*
+ * loadScript() - loads the parsed script: maps its cache file if the cache is up to date, or parses the script
+ * and (re)writes the cache otherwise
+ * Returns 0 on success, and -1 if the script cannot be read (the error message is printed).
+ */
+int loadScript(const char* path, scriptImage* img) {
+    struct stat st, cst;
+    int fd, cfd;
+    char* cachePath;
+    char* tmpPath;
+    char* text;
+    ssize_t n;
+    size_t done = 0;
+
+    if ((fd = open(path, O_RDONLY | O_CLOEXEC)) < 0 || fstat(fd, &st) != 0) {
+        printf("%s: unable to open the script: %s.\n", path, strerror(errno));
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+
+    cachePath = _scriptCachePath(&st);
+
+    // 1) Try the cache
+    if (cachePath != NULL && (cfd = open(cachePath, O_RDONLY | O_CLOEXEC)) >= 0) {
+        if (fstat(cfd, &cst) == 0 && (size_t) cst.st_size >= sizeof(scriptHeader)) {
+            img->length = cst.st_size;
+            img->base = mmap(NULL, img->length, PROT_READ, MAP_PRIVATE, cfd, 0);
+            img->mapped = 1;
+            if (img->base != MAP_FAILED) {
+                if (_setScriptPointers(img) == 0 && img->header->dev == (uint64_t) st.st_dev && img->header->ino == (uint64_t) st.st_ino
+                        && img->header->size == (uint64_t) st.st_size && img->header->mtimeSec == st.st_mtim.tv_sec
+                        && img->header->mtimeNsec == st.st_mtim.tv_nsec) {
+                    close(cfd);
+                    close(fd);
+                    free(cachePath);
+                    return 0;   // The cache is up to date
+                }
+                munmap(img->base, img->length);
+            }
+        }
+        close(cfd);
+    }
+
+    // 2) The cache is missing or outdated: read and parse the script
+    text = (char*) malloc(st.st_size + 1);
+    if (!text) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+    while (done < (size_t) st.st_size && (n = read(fd, text + done, st.st_size - done)) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            printf("%s: unable to read the script: %s.\n", path, strerror(errno));
+            free(text);
+            free(cachePath);
+            close(fd);
+            return -1;
+        }
+        done += n;
+    }
+    text[done] = '\0';
+    close(fd);
+
+    _parseScript(text, &st, img);
+    free(text);
+
+    // 3) Save the cache: write a temporary file and rename it, so that other shells running the same script never see a partial file.
+    //    If the cache cannot be saved, the script is still run; it will just be parsed again next time.
+    if (cachePath != NULL) {
+        tmpPath = (char*) malloc(strlen(cachePath) + 32);
+        if (!tmpPath) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
+        sprintf(tmpPath, "%s.tmp.%d", cachePath, getpid());
+        if ((cfd = open(tmpPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, S_IRUSR | S_IWUSR)) >= 0) {
+            if (write(cfd, img->base, img->length) == (ssize_t) img->length && close(cfd) == 0) rename(tmpPath, cachePath);
+            else {
+                close(cfd);
+                unlink(tmpPath);
+            }
+        }
+        free(tmpPath);
+        free(cachePath);
+    }
+    return 0;
+}
+
+// unloadScript() - frees the memory used by the script image
+void unloadScript(scriptImage* img) {
+    if (img->mapped) munmap(img->base, img->length);
+    else free(img->base);
+}
+
+/*
+ * runScript() - executes all the commands of the script, one after another
+ * Returns non-zero if the script executed the 'exit' built-in command.
+ */
+int runScript(const char* path) {
+    scriptImage img;
+    commandList list;   // the commands of the script
+    shellNode* tree;    // the parsed script
+    char** args;    // the arguments of all the commands (each command's arguments are followed by NULL); they point directly into the image
+    uint32_t c, i, w = 0;
+    int result;
+    int exitShell = 0;
+
+    if (loadScript(path, &img) != 0) return 0;
+
+    args = (char**) malloc((img.header->nwords + img.header->ncommands + 1) * sizeof(char*));
+    if (!args) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+
+    initCommandList(&list);
+    addListBuffer(&list, args);
+    for (c = 0; c < img.header->ncommands; c++) {
+        addListCommand(&list, args + w, img.commands[c].background,
+            img.commands[c].hereInput > 0 ? img.strings + img.commands[c].hereInput - 1 : NULL, img.commands[c].hereLength, img.commands[c].line);
+        for (i = 0; i < img.commands[c].nwords; i++) args[w++] = img.strings + img.words[img.commands[c].firstWord + i];
+        args[w++] = NULL;
+    }
+
+    // The whole script is parsed before anything is executed, so a script with a syntax error is not run at all
+    result = parseCommandList(&list, &tree);
+    if (result == PARSE_INCOMPLETE) printf("%s: syntax error: unexpected end of file.\n", path);
+    else if (result == PARSE_OK) exitShell = runNodes(tree) == RUN_EXIT;
+
+    freeNodes(tree);
+    freeCommandList(&list);
+    unloadScript(&img);
+    return exitShell;
+}
+
+/*
+ * ==== One-shot mode ====
+ *
+ * 'seashell -c command_line' executes a single command line and exits, which is what make and other task runners do with $SHELL.
+ * Nothing of the interactive machinery is set up: no banner, no prompt, no process group. If the last command of the command line
+ * is an external command (possibly prefixed with 'run' options), it is not forked at all - the shell applies the settings to itself
+ * and execv()s the command in place, so the command inherits the PID, and the only cost over executing it directly is one quiet
+ * PATH lookup. Everything else (the earlier commands, built-in commands, 'time', constructs, background jobs) is executed as usual.
+ */
+
+// Built-in commands which can't be replaced with an execv() in the one-shot mode
+const char* builtinNames[] = {"help", "cd", "exit", "jobs", "fg", "bg", "renice", "bgpolicy", "ulimit", "wait", "time", "capture", "output",
+    "true", "false", ":", "let", NULL};
+
+/*
+ * runOneShot() - executes the command line in the one-shot mode (see above)
+ * Returns the exit code of the shell: 127 if the command is not found, 126 if it can't be executed; if the command is executed in place,
+ * the function doesn't return at all.
+ */
+int runOneShot(char* line) {
+    commandList list;   // the commands of the command line
+    shellNode* tree;    // the parsed command line
+    shellNode* last;    // the last top-level command
+    shellNode* prev = NULL;
+    char** args;
+    int stdinFd = -1;
+    int optEnd = 0;
+    char* command;
+    schedOptions sched;
+    timeoutOptions timeout;
+    limitOptions limits;
+    int i;
+
+    oneShot = 1;
+    initSchedOptions(&bgPolicy);
+    initLimitOptions(&jobLimits);
+    initCommandList(&list);
+    if (addCommandLine(&list, line, 0) != 0) return 2;
+    if ((i = parseCommandList(&list, &tree)) != PARSE_OK) {
+        if (i == PARSE_INCOMPLETE) fprintf(stderr, "seashell: syntax error: unexpected end of the command line.\n");
+        return 2;
+    }
+    if (tree == NULL) return 0; // Nothing to do
+
+    // Everything before the last command is executed as usual
+    for (last = tree; last->next != NULL; last = last->next) prev = last;
+    if (prev != NULL) {
+        prev->next = NULL;
+        i = runNodes(tree);
+        prev->next = last;
+        if (i != RUN_OK) return context->lastStatus;
+    }
+
+    args = last->type == NODE_COMMAND && last->expand ? expandArgs(last->args) : last->args;
+    if (args == NULL && last->type == NODE_COMMAND && last->expand) return 1;  // An arithmetic expansion failed
+    if (last->type == NODE_COMMAND && args[0] != NULL) for (i = 0; builtinNames[i] != NULL && strcmp(args[0], builtinNames[i]) != 0; i++);
+    if (last->type != NODE_COMMAND || args[0] == NULL || builtinNames[i] != NULL || last->cmd->background || isAssignment(args[0])) {
+        // The shell has to stay around: go the usual way
+        runNodes(last);
+        updateStatus();
+        flushStatusBuffer();
+        return context->lastStatus;
+    }
+
+    // Execute the command in place of the shell
+    if (procs != NULL) {    // (the earlier commands may have left some status updates)
+        updateStatus();
+        flushStatusBuffer();
+    }
+    initSchedOptions(&sched);
+    initLimitOptions(&limits);
+    if (strcmp(args[0], "run") == 0 && ((optEnd = parseSchedOptions(args, 1, &sched, &timeout, &limits, "run")) < 0 || args[optEnd] == NULL)) {
+        fprintf(stderr, "seashell: run: please specify proper options and the command.\n");
+        return 2;
+    }
+    if (optEnd > 0 && timeout.timeout > 0) {    // Somebody has to enforce the deadline: the shell stays around
+        freeSchedOptions(&sched);
+        runNodes(last);
+        updateStatus();
+        flushStatusBuffer();
+        return context->lastStatus;
+    }
+    if ((command = findExecutable(args[optEnd], 0)) == NULL) {
+        fprintf(stderr, "seashell: [%s]: not a command\n", args[optEnd]);
+        return 127;
+    }
+    if (last->cmd->hereBody != NULL && (stdinFd = makeHereInput(last->cmd->hereBody, last->cmd->hereLength)) < 0) {
+        fprintf(stderr, "seashell: unable to create the here-string: %s.\n", strerror(errno));
+        return 2;
     }
+    applySchedOptions(&sched, 0);
+    mergeLimitOptions(&limits, &jobLimits); // (set by 'ulimit' earlier in the command line)
+    if (applyLimitOptions(&limits) != 0) return 126;    // The command is not run without its resource limits
+    if (stdinFd >= 0) {
+        dup2(stdinFd, STDIN_FILENO);
+        close(stdinFd);
+    }
+    fflush(stdout); // (execv() would discard what the earlier commands printed)
+    execv(command, args + optEnd);
+    fprintf(stderr, "seashell: %s: %s\n", command, strerror(errno));
+    return 126;
+}
 
-	while (*curchar != '\0') {  // Until we reach the end of the initial string
-		curchar += strspn(curchar, delims); // Skip all the delimiters in the beginning of the new section of the string
-        temp = curchar; // The new part starts here
-        shift = 0;  // Set shift to 0
-        if (*curchar == '\0') break;    // We may have reached the end of the initial string; in this case, we're done
+/*
+ * ==== Server mode ====
+ *
+ * 'seashell --serve socket_path' turns the shell into a local command execution server: it listens on the Unix domain socket and
+ * accepts any number of concurrent client sessions. Each session has its own working directory, job table, shell variables and $?
+ * (a shellContext, which is made current while a command line of the session is executed), and all the
+ * sessions are served by a single process in one event loop (epoll), together with the output of their jobs and the SIGCHLD
+ * notifications (signalfd). The PATH lookups are cached for the whole lifetime of the server.
+ *
+ * The protocol is line-based. The client sends command lines; they are executed one after another, like at the command prompt
+ * (a command line ending with '&' starts a background job and doesn't block the next one). The standard output and the standard
+ * error of the jobs are streamed back as they are produced, and every job is concluded with a status line:
+ *   [exit N]            - a foreground job exited with the code N
+ *   [signal N]          - a foreground job was killed by the signal N
+ *   [J] PID=P started   - a background job J was started
+ *   [J] exit N / [J] signal N - a background job J finished
+ *   [error message]     - the command line could not be executed
+ * Supported built-in commands: cd, jobs, run, exit, let, true, false, ':' and assignments. Commands may be separated with ';' (the ones
+ * after a foreground job wait until it finishes), and $name, ${name}, $?, $$ and $(( )) are expanded. if/while/for are not supported:
+ * the session would have to stop in the middle of a construct while a job runs. Here-strings (<<<) are supported; here-documents are not.
+ */
 
-        while (*curchar != '\0') {  // Break if we have reached the end of the initial string
-            // If the current character is...
-            if (*curchar == '\\') { // If the current character is an escape character, i.e. the backslash...
-                curchar++;  // 1) go to the next character
-                shift++;    // 2) increase the shift (since we're deleting the backslash)
-                *(curchar - shift) = *curchar;  // 3) just copy the character after the backslash without processing it normally
-                if (*curchar != '\0') curchar++;    // 4) go to the next character (unless we're at the end of the initial string)
-            }
-            else if ((strchr(delims, *curchar) != NULL) && !doublequotes) { // If the current character is a delimiter AND the double quotes have not been opened...
-                break;  // the end of the section reached, save this section to 'parts' and start a new one
-            }
-            else if (*curchar == '"') { // If the current character is a double quote...
-                doublequotes = !doublequotes;   // 1) switch the 'doublequotes' flag
-                curchar++;  // 2) advance to the next character
-                shift++;    // 3) increase the shift since we deleted the double quote
-            }
-            else {  // For any other character:
-                *(curchar - shift) = *curchar;  // 1) copy the character to its new position
-                curchar++;  // 2) go to the next character
+#define SERVE_MAX_EVENTS 64 // Events processed per epoll_wait() call
+#define SERVE_OUT_LIMIT (1 << 20)   // When this much output waits to be sent to a client, the output of its jobs is not read until it drains
+#define PATH_CACHE_BUCKETS 128  // Size of the PATH lookup cache hash table
+
+// What a file descriptor registered with epoll belongs to
+#define WATCH_NONE 0
+#define WATCH_LISTEN 1  // the listening socket
+#define WATCH_SIGNAL 2  // the signalfd for SIGCHLD
+#define WATCH_CLIENT 3  // a client socket
+#define WATCH_JOB 4 // the read end of the pipe with the output of a job
+
+// serveSession - a struct type for the state of one client session
+typedef struct serveSession {
+    int fd; // the client socket (non-blocking)
+    int cwdFd;  // working directory of the session (an open directory; the jobs fchdir() to it)
+    processRecord* procs;   // job table of the session: a doubly linked list, like the main job table, but the job IDs are stable
+    processRecord* currentProc; // the foreground job of the session; further command lines wait until it finishes
+    unsigned int nextJobNum;    // ID of the next job
+    char* in;   // received input which hasn't been executed yet
+    size_t inLen, inCap;
+    char* out;  // output waiting to be sent to the client
+    size_t outLen, outCap;
+    int eof;    // non-zero if the client has sent all of its input
+    int closing;    // non-zero if 'exit' was executed; the session is closed once the foreground job is finished and the output is sent
+    shellContext context;   // the shell variables and $? of the session
+    int throttled;  // non-zero if the output of the jobs is not being read because the client is too slow
+
+    struct serveSession* prev;
+    struct serveSession* next;
+} serveSession;
+
+// serveWatch - a struct type for the items of the table mapping the watched file descriptors to what they belong to
+typedef struct serveWatch {
+    int kind;   // WATCH_...
+    serveSession* session;
+    processRecord* job;
+} serveWatch;
+
+// pathCacheItem - a struct type for the items of the PATH lookup cache (a hash table with chaining)
+typedef struct pathCacheItem {
+    char* name; // name of the command
+    char* path; // path to its executable
+    struct pathCacheItem* next;
+} pathCacheItem;
+
+int serveEpoll = -1;    // the epoll instance of the server
+serveWatch* serveWatches = NULL;    // the watched file descriptors, indexed by the file descriptor
+int serveWatchesCap = 0;
+serveSession* serveSessions = NULL; // all the sessions
+sigset_t serveOldMask;  // the signal mask before SIGCHLD was blocked; restored in the children
+pathCacheItem* pathCache[PATH_CACHE_BUCKETS];
+
+/*
+ * cachedFindExecutable() - the same as findExecutable() (not verbose), but the result is remembered. A remembered path is only
+ * checked with a single access() call, instead of searching through all the PATH directories again.
+ */
+char* cachedFindExecutable(const char* name) {
+    unsigned int h = 5381;
+    const char* c;
+    pathCacheItem** item;
+    pathCacheItem* found;
+    char* path;
+
+    if (strchr(name, '/') != NULL) return findExecutable(name, 0); // Explicit paths are not searched for anyway
+
+    for (c = name; *c != '\0'; c++) h = h * 33 + (unsigned char) *c;
+    for (item = &pathCache[h % PATH_CACHE_BUCKETS]; *item != NULL; item = &(*item)->next) {
+        if (strcmp((*item)->name, name) != 0) continue;
+        if (access((*item)->path, X_OK) == 0) {
+            path = (char*) malloc(strlen((*item)->path) + 1);
+            if (!path) {
+                fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+                exit(2);
             }
+            return strcpy(path, (*item)->path);
         }
+        // The executable is gone: forget it and search again
+        found = *item;
+        *item = found->next;
+        free(found->name);
+        free(found->path);
+        free(found);
+        break;
+    }
 
-        // In any case, we need to mark the end of the current section with a '\0', but then, unless we're at the end of the
-        // initial string, we need to advance the curchar
-        if (*curchar != '\0') {
-            *(curchar - shift) = '\0';
-            curchar++;
+    if ((path = findExecutable(name, 0)) == NULL) return NULL;
+
+    found = (pathCacheItem*) malloc(sizeof(pathCacheItem));
+    if (found) {
+        found->name = (char*) malloc(strlen(name) + 1);
+        found->path = (char*) malloc(strlen(path) + 1);
+    }
+    if (!found || !found->name || !found->path) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+    strcpy(found->name, name);
+    strcpy(found->path, path);
+    found->next = pathCache[h % PATH_CACHE_BUCKETS];
+    pathCache[h % PATH_CACHE_BUCKETS] = found;
+    return path;
+}
+
+/*
+ * serveWatchFd() - registers a file descriptor with epoll (or changes the events of an already registered one)
+ * Arguments:
+ * fd - the file descriptor;
+ * events - epoll events (0 to stop watching for events temporarily);
+ * kind, session, job - what the file descriptor belongs to.
+ */
+void serveWatchFd(int fd, unsigned int events, int kind, serveSession* session, processRecord* job) {
+    struct epoll_event ev;
+    int op = (fd < serveWatchesCap && serveWatches[fd].kind != WATCH_NONE) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+
+    if (fd >= serveWatchesCap) {
+        int cap = serveWatchesCap;
+        serveWatchesCap = fd + 64;
+        serveWatches = (serveWatch*) realloc(serveWatches, serveWatchesCap * sizeof(serveWatch));
+        if (!serveWatches) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
         }
-        else *(curchar - shift) = '\0';
+        memset(serveWatches + cap, 0, (serveWatchesCap - cap) * sizeof(serveWatch));
+    }
 
-        parts[pos] = temp;  // save the current section
-        pos++;
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(serveEpoll, op, fd, &ev) != 0) {
+        fprintf(stderr, "\nFATAL ERROR (UNKNOWN): epoll_ctl() system call failed. Terminating...\n");
+        exit(3);
+    }
+    serveWatches[fd].kind = kind;
+    serveWatches[fd].session = session;
+    serveWatches[fd].job = job;
+}
 
-        if (pos >= bufsize) {   // If the current size of the 'parts' array is exceeded, we will need to increase it
-			bufsize += 16;
-			parts = (char**) realloc(parts, bufsize * sizeof(char*));
-			if (!parts) {
-				fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
-				exit(2);
-			}
-		}
-	}
+// serveUnwatchFd() - stops watching a file descriptor and closes it
+void serveUnwatchFd(int fd) {
+    epoll_ctl(serveEpoll, EPOLL_CTL_DEL, fd, NULL);
+    serveWatches[fd].kind = WATCH_NONE;
+    close(fd);
+}
 
-	parts[pos] = NULL;  // The last item of the array should be the NULL pointer
-	return parts;
+// serveThrottle() - stops (throttle != 0) or resumes reading the output of all the jobs of the session
+void serveThrottle(serveSession* s, int throttle) {
+    processRecord* p;
+
+    if (s->throttled == throttle) return;
+    s->throttled = throttle;
+    for (p = s->procs; p != NULL; p = p->next) {
+        if (p->outFd >= 0) serveWatchFd(p->outFd, throttle ? 0 : EPOLLIN, WATCH_JOB, s, p);
+    }
 }
 
-int main(int argc, char** argv) {
-    char* prompt;   // command prompt; basically, the current working directory
-    char* inputstr; // the raw string that we input as the command line
-    char* pathvar;  // the string to store the content of the PATH environment variable
-    char* command;  // the path to the executable to be run
-    char** paths;   // components of the PATH environment variable
-    char** searchpaths; // array of locations where the executable is to be searched for
-    char** args;    // parsed command line arguments to be passed to the command
-    unsigned int i; // integer counter; to be used in several places for different reasons
-    processRecord* p;   // to be used in the 'jobs' built-in command
-    size_t zero = 0;    // this is to be passed to getline()
-    ssize_t linelength; // the return value of getline() will be stored here
-    int bckgr;  // the background flag, as determined from the command line (by the presence of the '&' suffix)
+// serveClientEvents() - the epoll events to watch for on the client socket of the session
+unsigned int serveClientEvents(serveSession* s) {
+    return (s->eof ? 0 : EPOLLIN) | (s->outLen > 0 ? EPOLLOUT : 0);
+}
 
-    if (setpgid (getpid(), getpid()) < 0) { // Put the shell into its own process group
-        fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to set the PGID for the main process. Terminating...\n");
-        exit(3);
+// serveSend() - queues data to be sent to the client of the session
+void serveSend(serveSession* s, const char* data, size_t len) {
+    if (s->outLen + len > s->outCap) {
+        while (s->outLen + len > s->outCap) s->outCap = s->outCap ? s->outCap * 2 : 4096;
+        s->out = (char*) realloc(s->out, s->outCap);
+        if (!s->out) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
+        }
     }
+    memcpy(s->out + s->outLen, data, len);
+    if (s->outLen == 0) {   // Wait until the socket is writable
+        s->outLen = len;
+        serveWatchFd(s->fd, serveClientEvents(s), WATCH_CLIENT, s, NULL);
+    }
+    else s->outLen += len;
 
-    printAbout();   // Print the About message
+    if (s->outLen > SERVE_OUT_LIMIT) serveThrottle(s, 1);
+}
 
-    while (1) {
-        updateStatus(); // See if any processes stopped/terminated and we don't know about it
-        flushStatusBuffer();    // Print all the execution status update messages accumulated since the command prompt was displayed the last time
+// servePrintf() - formats a message and queues it to be sent to the client of the session
+void servePrintf(serveSession* s, const char* format, ...) {
+    char buf[1024];
+    va_list ap;
+    int n;
 
-        // Display the command prompt
-        prompt = getdir();
-        printf("%s> ", prompt);
+    va_start(ap, format);
+    n = vsnprintf(buf, sizeof(buf), format, ap);
+    va_end(ap);
+    if (n > 0) serveSend(s, buf, n < (int) sizeof(buf) ? (size_t) n : sizeof(buf) - 1);
+}
 
-        // Read the command line
-        zero = 0;
-        inputstr = NULL;
-        linelength = getline(&inputstr, &zero, stdin);
+/*
+ * serveCloseSession() - closes the session: its jobs get SIGHUP (their process groups are then forgotten; the server still reaps them),
+ * and all the resources of the session are freed
+ */
+void serveCloseSession(serveSession* s) {
+    processRecord* p;
 
-        // Was getline() call successful?
-        if (linelength < 0) {
-            if (feof(stdin)) {
-                break;  // The user pressed Ctrl-D
-            }
-            else {  // Something unexpected and bad happened
-                fprintf(stderr, "FATAL ERROR (I/O): Unable to read the command. Terminating...\n");
-                exit(1);
-            }
+    while ((p = s->procs) != NULL) {
+        if (p->status == running || p->status == stopped) {
+            kill(-p->pid, SIGHUP);
+            kill(-p->pid, SIGCONT);
         }
+        if (p->outFd >= 0) serveUnwatchFd(p->outFd);
+        if (p->pidfd >= 0) close(p->pidfd);
+        s->procs = p->next;
+        free(p->command);
+        free(p);
+    }
 
-        // Parse the command line: generate the command line arguments array
-		args = strsplit(inputstr, " \t\v\r\n\a");
+    if (s->fd >= 0) serveUnwatchFd(s->fd);
+    close(s->cwdFd);
+    if (s->prev != NULL) s->prev->next = s->next;
+    else serveSessions = s->next;
+    if (s->next != NULL) s->next->prev = s->prev;
+    freeVariables(&s->context);
+    free(s->in);
+    free(s->out);
+    free(s);
+}
 
-        // Determine whether the command line had the '&' suffix; if there was
-        // such suffix, set the background flag to 1 and delete this suffix from the resulting array
-        i = 0;
-        while (args[i] != NULL) i++;
-        if (i > 0) {
-            i--;
-            if (strlen(args[i]) > 0 && (args[i][strlen(args[i]) - 1] == '&')) {
-                bckgr = 1;
-                if (strlen(args[i]) < 2) {
-                    args[i] = NULL;
-                }
-                else {
-                    args[i][strlen(args[i]) - 1] = '\0';
-                }
-            }
-            else {
-                bckgr = 0;
-            }
-        }
+/*
+ * serveFinishJob() - reports a finished job to the client and removes it from the job table of the session
+ * A job is finished when it has terminated and all of its output has been read.
+ */
+void serveFinishJob(serveSession* s, processRecord* p) {
+    if (p->status != done && p->status != terminated) return;   // still running
+    if (p->outFd >= 0) return;  // there's still some output to read
 
-        // If the command line was essentially empty, jump to the next command line prompt
-        if (args[0] == NULL || strlen(args[0]) < 1) {
-            free(inputstr);
-            free(args);
-            free(prompt);
-            continue;
-        }
+    if (p->background) {
+        if (p->status == done) servePrintf(s, "[%u] exit %d\n", p->jobId, WEXITSTATUS(p->exitCode));
+        else servePrintf(s, "[%u] signal %d\n", p->jobId, WTERMSIG(p->exitCode));
+    }
+    else if (p->status == done) servePrintf(s, "[exit %d]\n", WEXITSTATUS(p->exitCode));
+    else servePrintf(s, "[signal %d]\n", WTERMSIG(p->exitCode));
+
+    if (p->prev != NULL) p->prev->next = p->next;
+    else s->procs = p->next;
+    if (p->next != NULL) p->next->prev = p->prev;
+    if (p->pidfd >= 0) close(p->pidfd);
+    if (s->currentProc == p) {
+        s->currentProc = NULL;
+        s->context.lastStatus = exitStatusOf(p);
+    }
+    free(p->command);
+    free(p);
+}
 
-        // Process built-in commands...
-        if (strcmp(args[0], "help") == 0) { // 'help' built-in command
-            fprintf(stderr, "help is a built-in command\n");
+/*
+ * serveLaunch() - launches an external command for the session
+ * The child gets its own process group, the working directory of the session, /dev/null (or the here-string) as the standard input,
+ * and a pipe as the standard output and the standard error.
+ */
+void serveLaunch(serveSession* s, char** args, int bckgr, launchOptions* opts) {
+    char* command = cachedFindExecutable(args[0]);
+    int out[2];
+    pid_t pid;
+    processRecord* p;
+    int c;
 
-            printHelp();   // Print the Help message 
-        }
-        else if (strcmp(args[0], "cd") == 0) { // 'cd' built-in command
-            fprintf(stderr, "cd is a built-in command\n");
+    if (command == NULL) {
+        servePrintf(s, "[error [%s]: not a command]\n", args[0]);
+        context->lastStatus = 127;
+        return;
+    }
+    context->lastStatus = 126; // (unless the job is started)
+    if (pipe2(out, O_CLOEXEC) != 0) {
+        servePrintf(s, "[error unable to create a pipe: %s]\n", strerror(errno));
+        free(command);
+        return;
+    }
 
-            if (args[1] == NULL || strlen(args[1]) < 1) printf("cd: please specify a proper directory.\n"); // we need the first argument to be present and not empty
-            else {
-                printf("Switching to [%s]...\n", args[1]);
-                if (chdir(args[1]) != 0) {  // try to switch the working directory to the one passed as the first argument
-                    // Apparently, we have some error
-                    if (errno == EACCES) printf("cd: access denied.\n");
-                    else if (errno == ENOENT) printf("cd: directory not found.\n");
-                    else if (errno == ENOTDIR) printf("cd: the specified path is not a directory.\n");
-                    else if (errno == ENAMETOOLONG) printf("cd: the path is too long.\n");
-                    else {  // Unexpected error
-                        fprintf(stderr, "\nFATAL ERROR (UNKNOWN): chdir() system call failed. Terminating...\n");
-                        exit(3);
-                    }
-                }
+    pid = fork();
+    if (pid < 0) {
+        servePrintf(s, "[error unable to create the process: %s]\n", strerror(errno));
+        close(out[0]);
+        close(out[1]);
+        free(command);
+        return;
+    }
+    if (pid == 0) { // We're in the child process now
+        sigprocmask(SIG_SETMASK, &serveOldMask, NULL);  // SIGCHLD is blocked only in the server itself
+        signal(SIGPIPE, SIG_DFL);
+        setpgid(0, 0);
+        if (fchdir(s->cwdFd) != 0) _exit(126);
+        if (opts->stdinFd >= 0) dup2(opts->stdinFd, STDIN_FILENO);
+        else {
+            int devnull = open("/dev/null", O_RDONLY);
+            if (devnull >= 0 && devnull != STDIN_FILENO) {
+                dup2(devnull, STDIN_FILENO);
+                close(devnull);
             }
         }
-        else if (strcmp(args[0], "exit") == 0) { // 'exit' built-in command
-            fprintf(stderr, "exit is a built-in command\n");
+        dup2(out[1], STDOUT_FILENO);
+        dup2(out[1], STDERR_FILENO);
+        applySchedOptions(&opts->sched, 0);
+        if (applyLimitOptions(&opts->limits) != 0) _exit(126);
+        execv(command, args);
+        fprintf(stderr, "%s: %s\n", command, strerror(errno));
+        _exit(127);
+    }
 
-            free(inputstr);
-            free(args);
-            free(prompt);
-            break;  // Exit the shell
-        }
-        else if (strcmp(args[0], "jobs") == 0) { // 'jobs' built-in command
-            fprintf(stderr, "jobs is a built-in command\n");
+    // We're in the server
+    close(out[1]);
+    setpgid(pid, pid);  // (also done by the child; whichever comes first)
 
-            printf("%d jobs in total.\n\n", nextJobNum - 1);
-            p = procs;
-            // Go through the whole job table printing information about each and every process there
-            for (i = 1; p != NULL; i++) {
-                _printProcInfo(p, i, p->background, p->status, p->exitCode);
-                p = p->next;
+    p = (processRecord*) malloc(sizeof(processRecord));
+    if (!p) {
+        fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+        exit(2);
+    }
+    memset(p, 0, sizeof(processRecord));
+    p->command = command;
+    p->pid = pid;
+    p->pidfd = -1;
+    p->status = running;
+    p->background = bckgr;
+    p->jobId = s->nextJobNum++;
+    p->outFd = out[0];
+    p->statusSlot = STATUS_SLOT_NONE;
+    p->deadlineSlot = -1;
+    initSchedOptions(&p->sched);
+    p->limits = opts->limits;
+    p->limitHit = LIMIT_NONE;
+    p->timed = TIME_NONE;
+    for (c = 0; c < PERF_COUNTERS; c++) p->perfFds[c] = -1;
+
+    // Add the job to the job table of the session
+    p->prev = NULL;
+    p->next = s->procs;
+    if (s->procs != NULL) s->procs->prev = p;
+    s->procs = p;
+
+    serveWatchFd(p->outFd, s->throttled ? 0 : EPOLLIN, WATCH_JOB, s, p);
+
+    context->lastStatus = 0; // A foreground job sets $? when it finishes (see serveFinishJob())
+    if (bckgr) servePrintf(s, "[%u] PID=%d started\n", p->jobId, pid);
+    else s->currentProc = p;
+}
+
+/*
+ * serveRunCommand() - executes one command of the session (in its context: the variables and $? of the session)
+ * Assignments, 'let', 'true', 'false' and ':' work as at the command prompt (if/while/for are refused by serveRunLine()).
+ */
+void serveRunCommand(serveSession* s, char* command) {
+    char** hereOps; // the unquoted here-document/here-string operators of the command (see splitWords())
+    char** split = splitWords(command, " \t\v\r\n\a", &hereOps);
+    char** args = split;
+    int bckgr;
+    char* hereWord;
+    char* hereBody = NULL;
+    size_t hereLen = 0, hereCap = 0;
+    int hereType;
+    int optEnd;
+    processRecord* p;
+    launchOptions opts;
+    int64_t value = 0;
+    unsigned int i;
+
+    joinArithmetic(split);
+    bckgr = stripBackground(split);
+    initSchedOptions(&opts.sched);
+    opts.stdinFd = -1;
+    opts.timed = TIME_NONE;
+    opts.timeout.set = 0;
+    opts.timeout.timeout = 0;
+    opts.timeout.killAfter = 0;
+    initLimitOptions(&opts.limits);
+
+    hereType = extractHereInput(split, hereOps, &hereWord);
+    free(hereOps);
+    if (hereType == HERE_ERROR || hereType == HERE_DOC || hereType == HERE_DOC_STRIPTABS) {
+        servePrintf(s, "[error here-documents are not supported in the server mode; use <<< instead]\n");
+        context->lastStatus = 2;
+    }
+    else if (split[0] == NULL || strlen(split[0]) < 1 || split[0][0] == '#') {
+        // Nothing to do
+    }
+    else if (_hasDollar(split) && (args = expandArgs(split)) == NULL) {
+        servePrintf(s, "[error arithmetic expansion failed]\n");
+        args = split;
+        context->lastStatus = 1;
+    }
+    else if (args[0] == NULL) {
+        // Nothing to do (only empty variables)
+    }
+    else if (isAssignment(args[0])) {
+        for (i = 0; args[i] != NULL && isAssignment(args[i]); i++);
+        if (args[i] != NULL) {
+            servePrintf(s, "[error assignments before a command are not supported]\n");
+            context->lastStatus = 2;
+        }
+        else {
+            for (i = 0; args[i] != NULL; i++) setVariable(args[i], _nameLength(args[i]), args[i] + _nameLength(args[i]) + 1);
+            context->lastStatus = 0;
+        }
+    }
+    else if (strcmp(args[0], "true") == 0 || strcmp(args[0], ":") == 0 || strcmp(args[0], "false") == 0) {
+        context->lastStatus = strcmp(args[0], "false") == 0;
+    }
+    else if (strcmp(args[0], "let") == 0) {
+        for (i = 1; args[i] != NULL && evalArith(args[i], strlen(args[i]), &value, 0) == 0; i++);
+        if (args[1] == NULL || args[i] != NULL) servePrintf(s, "[error let: please specify proper expressions]\n");
+        context->lastStatus = args[1] != NULL && args[i] == NULL && value != 0 ? 0 : 1;
+    }
+    else if (strcmp(args[0], "exit") == 0) {
+        s->closing = 1;
+    }
+    else if (strcmp(args[0], "cd") == 0) {
+        int fd;
+        context->lastStatus = 1;
+        if (args[1] == NULL || strlen(args[1]) < 1) servePrintf(s, "[error cd: please specify a proper directory]\n");
+        else if ((fd = openat(s->cwdFd, args[1], O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+            servePrintf(s, "[error cd: %s]\n", strerror(errno));
+        }
+        else {
+            close(s->cwdFd);
+            s->cwdFd = fd;
+            context->lastStatus = 0;
+        }
+    }
+    else if (strcmp(args[0], "jobs") == 0) {
+        context->lastStatus = 0;
+        for (p = s->procs; p != NULL; p = p->next) {
+            servePrintf(s, "[%u] PID=%d\t%s\t%s%s\n", p->jobId, p->pid, p->status == running ? "Running" : "Done", p->command,
+                p->background ? " &" : "");
+        }
+    }
+    else {
+        optEnd = 0;
+        if (strcmp(args[0], "run") == 0) optEnd = parseSchedOptions(args, 1, &opts.sched, NULL, &opts.limits, "run");
+        context->lastStatus = 2;
+        if (optEnd < 0 || args[optEnd] == NULL) servePrintf(s, "[error run: please specify proper options and the command]\n");
+        else {
+            if (hereType == HERE_STRING) {
+                appendHereLine(&hereBody, &hereLen, &hereCap, hereWord, 0);
+                opts.stdinFd = makeHereInput(hereBody, hereLen);
             }
+            if (hereType == HERE_STRING && opts.stdinFd < 0) servePrintf(s, "[error unable to create the here-string: %s]\n", strerror(errno));
+            else serveLaunch(s, args + optEnd, bckgr, &opts);
         }
-        else if (strcmp(args[0], "fg") == 0) { // 'fg' built-in command
-            fprintf(stderr, "fg is a built-in command\n");
+    }
 
-            // 1) Make sure we have the 1st argument not empty
-            if (args[1] == NULL || strlen(args[1]) < 1) printf("fg: please specify a proper job number.\n");
-            else {
-                char* firstNonNumber = args[1];
-                unsigned int jN = strtoul(args[1], &firstNonNumber, 0);
-                // 2) Make sure that the first argument is a positive integer in the valid range
-                if (jN < 1 || jN >= nextJobNum || *firstNonNumber != '\0') printf("fg: please specify a proper job number.\n");
-                else {
-                    // 3) Call resumeProcess() with background flag set to 0
-                    resumeProcess(jN, 0);
-                }
-            }
+    if (opts.stdinFd >= 0) close(opts.stdinFd);
+    freeSchedOptions(&opts.sched);
+    free(hereBody);
+    if (args != split) freeArgs(args);
+    free(split);
+}
+
+/*
+ * serveRunLine() - executes the commands of a command line of the session, separated with ';', until one of them starts
+ * a foreground job
+ * Returns the rest of the command line (allocated with malloc()), to be executed once the foreground job is finished; NULL if
+ * the whole line has been executed.
+ */
+char* serveRunLine(serveSession* s, char* line) {
+    char** pieces = splitCommands(line);
+    char* rest = NULL;
+    char* word;
+    unsigned int i, j;
+    size_t len;
+
+    // The control flow constructs are refused as a whole, before anything is executed
+    for (i = 0; pieces[i] != NULL; i++) {
+        word = pieces[i] + strspn(pieces[i], " \t\v\r\n\a");
+        len = strcspn(word, " \t\v\r\n\a");
+        for (j = 0; shellKeywords[j] != NULL && !(strlen(shellKeywords[j]) == len && strncmp(word, shellKeywords[j], len) == 0); j++);
+        if (shellKeywords[j] != NULL) {
+            servePrintf(s, "[error %s: if, while and for are not supported in the server mode]\n", shellKeywords[j]);
+            s->context.lastStatus = 2;
+            free(pieces);
+            return NULL;
         }
-        else if (strcmp(args[0], "bg") == 0) { // 'bg' built-in command
-            fprintf(stderr, "bg is a built-in command\n");
+    }
 
-            // 1) Make sure we have the 1st argument not empty
-            if (args[1] == NULL || strlen(args[1]) < 1) printf("bg: please specify a proper job number.\n");
-            else {
-                char* firstNonNumber = args[1];
-                unsigned int jN = strtoul(args[1], &firstNonNumber, 0);
-                // 2) Make sure that the first argument is a positive integer in the valid range
-                if (jN < 1 || jN >= nextJobNum || *firstNonNumber != '\0') printf("bg: please specify a proper job number.\n");
-                else {
-                    // 3) Call resumeProcess() with background flag set to 1
-                    resumeProcess(jN, 1);
-                }
-            }
+    context = &s->context;  // The commands see the variables and $? of the session
+    for (i = 0; pieces[i] != NULL && s->currentProc == NULL && !s->closing; i++) serveRunCommand(s, pieces[i]);
+    context = &mainContext;
+
+    if (pieces[i] != NULL && !s->closing) {
+        for (j = i + 1; pieces[j] != NULL; j++) pieces[j][-1] = ';';   // (splitCommands() has put '\0' in place of the ';')
+        rest = (char*) malloc(strlen(pieces[i]) + 1);
+        if (!rest) {
+            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+            exit(2);
         }
-        else {  // Process external commands
-            // If args[0] does not contain '/', we will look for the file named (args[0]) in the directories contained in the PATH environment variable
-            // Otherwise, we'll try to locate the executable exactly where args[0] points to
-            if (strchr(args[0], '/') == NULL) {
-                pathvar = (char*) malloc(strlen(getenv("PATH")) + 1);
+        strcpy(rest, pieces[i]);
+    }
+    free(pieces);
+    return rest;
+}
 
-                if (!pathvar) {
+/*
+ * serveProcessInput() - executes the complete command lines received from the client, as long as there's no foreground job
+ * Returns non-zero if the session has been closed.
+ */
+int serveProcessInput(serveSession* s) {
+    char* eol;
+    char* rest;
+    size_t len;
+
+    while (s->currentProc == NULL && !s->closing && s->inLen > 0) {
+        if ((eol = (char*) memchr(s->in, '\n', s->inLen)) != NULL) {
+            *eol = '\0';
+            len = eol - s->in + 1;
+        }
+        else if (s->eof) {  // The last line may lack '\n'
+            s->in[s->inLen] = '\0';
+            len = s->inLen;
+        }
+        else break;
+        rest = serveRunLine(s, s->in);
+        memmove(s->in, s->in + len, s->inLen - len);
+        s->inLen -= len;
+
+        // The commands after a foreground job go back to the input, to be executed once it has finished
+        if (rest != NULL) {
+            len = strlen(rest) + 1;
+            if (s->inLen + len + 1 > s->inCap) {
+                s->inCap = s->inLen + len + 1;
+                s->in = (char*) realloc(s->in, s->inCap);
+                if (!s->in) {
                     fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
                     exit(2);
                 }
+            }
+            memmove(s->in + len, s->in, s->inLen);
+            memcpy(s->in, rest, len - 1);
+            s->in[len - 1] = '\n';
+            s->inLen += len;
+            free(rest);
+        }
+    }
+
+    // A session is closed after 'exit' (its background jobs are killed), or at the end of input once all of its jobs are finished;
+    // but only when all the output is sent
+    if ((s->closing ? s->currentProc == NULL : s->eof && s->inLen == 0 && s->procs == NULL) && s->outLen == 0) {
+        serveCloseSession(s);
+        return 1;
+    }
+    return 0;
+}
+
+// serveReap() - reaps all the terminated children and finishes their jobs
+void serveReap() {
+    int status;
+    pid_t pid;
+    serveSession* s;
+    serveSession* next;
+    processRecord* p;
+
+    while ((pid = waitpid(WAIT_ANY, &status, WNOHANG)) > 0) {
+        for (s = serveSessions; s != NULL; s = next) {
+            next = s->next;
+            for (p = s->procs; p != NULL && p->pid != pid; p = p->next);
+            if (p == NULL) continue;
+
+            p->exitCode = status;
+            p->status = WIFEXITED(status) ? done : terminated;
+            serveFinishJob(s, p);
+            serveProcessInput(s);   // The foreground job may have finished, so the next command line may be executed
+            break;
+        }
+        // If the job is not found, it belonged to a closed session; it's simply reaped
+    }
+}
 
-                strcpy(pathvar, getenv("PATH"));    // Copy the content of the PATH variable
-                paths = strsplit(pathvar, ":"); // Split the PATH variable into the array of strings; each of those strings is a path to a directory
+/*
+ * serveMain() - runs the shell in the server mode (see above) on the Unix domain socket at 'path'
+ * Returns the exit code of the shell.
+ */
+int serveMain(const char* path) {
+    struct sockaddr_un addr;
+    struct epoll_event events[SERVE_MAX_EVENTS];
+    struct signalfd_siginfo si;
+    sigset_t mask;
+    int listenFd, sigFd, n, i, fd;
+    char buf[65536];
+    ssize_t len;
+    serveSession* s;
+    processRecord* p;
+
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "seashell: the socket path is too long.\n");
+        return 1;
+    }
 
-                i = 0;
-                while (paths[i] != NULL) i++;
-                // Here, i contains the number of different paths in the PATH variable
+    // SIGCHLD is received through a signalfd, so it is blocked; SIGPIPE is ignored, since the clients may go away at any moment
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, &serveOldMask);
+    signal(SIGPIPE, SIG_IGN);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);   // A stale socket from a previous run
+
+    if ((listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0
+            || bind(listenFd, (struct sockaddr*) &addr, sizeof(addr)) != 0 || listen(listenFd, SOMAXCONN) != 0) {
+        fprintf(stderr, "seashell: unable to listen on [%s]: %s.\n", path, strerror(errno));
+        return 1;
+    }
+    if ((serveEpoll = epoll_create1(EPOLL_CLOEXEC)) < 0 || (sigFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) < 0) {
+        fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to initialize the event loop. Terminating...\n");
+        exit(3);
+    }
+    serveWatchFd(listenFd, EPOLLIN, WATCH_LISTEN, NULL, NULL);
+    serveWatchFd(sigFd, EPOLLIN, WATCH_SIGNAL, NULL, NULL);
 
-                searchpaths = (char**) malloc((i + 1) * sizeof(char*)); // i paths + 1 NULL pointer
+    fprintf(stderr, "Sea Shell is serving on [%s].\n", path);
 
-                if (!searchpaths) {
-                    fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
-                    exit(2);
-                }
+    while (1) {
+        if ((n = epoll_wait(serveEpoll, events, SERVE_MAX_EVENTS, -1)) < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): epoll_wait() system call failed. Terminating...\n");
+            exit(3);
+        }
 
-                i = 0;
-                while (paths[i] != NULL) {  // Go through the whole 'paths' array
-                    // Each string in the 'searchpaths' will contain the respective path from 'paths' + '/' + args[0] + '\0'
-                    searchpaths[i] = (char*) malloc(strlen(paths[i]) + 2 + strlen(args[0]));
-                    if (!(searchpaths[i])) {
+        for (i = 0; i < n; i++) {
+            fd = events[i].data.fd;
+            if (fd >= serveWatchesCap || serveWatches[fd].kind == WATCH_NONE) continue;  // closed while handling an earlier event
+            s = serveWatches[fd].session;
+            p = serveWatches[fd].job;
+
+            switch (serveWatches[fd].kind) {
+            case WATCH_LISTEN:  // New clients
+                while ((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+                    s = (serveSession*) calloc(1, sizeof(serveSession));
+                    if (!s) {
                         fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
                         exit(2);
                     }
-
-                    strcpy(searchpaths[i], paths[i]);
-                    strcat(searchpaths[i], "/");
-                    strcat(searchpaths[i], args[0]);
-                    i++;
+                    s->fd = fd;
+                    s->nextJobNum = 1;
+                    if ((s->cwdFd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+                        close(fd);
+                        free(s);
+                        continue;
+                    }
+                    s->next = serveSessions;
+                    if (serveSessions != NULL) serveSessions->prev = s;
+                    serveSessions = s;
+                    serveWatchFd(fd, EPOLLIN, WATCH_CLIENT, s, NULL);
                 }
-                searchpaths[i] = NULL;  // 'searchpaths' should end with the NULL pointer
-
-                free(pathvar);
-                free(paths);
-            }
-            else {  // The case when args[0] contains a '/'
-                // 'searchpaths' array will contain a copy of args[0] and a NULL pointer
-                searchpaths = (char**) malloc(2 * sizeof(char*));
-
-                if (!searchpaths) {
-                    fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
-                    exit(2);
+                break;
+
+            case WATCH_SIGNAL:  // Children terminated
+                while (read(sigFd, &si, sizeof(si)) == sizeof(si));
+                serveReap();
+                break;
+
+            case WATCH_JOB: // Output of a job: forward it to the client
+                len = read(fd, buf, sizeof(buf));
+                if (len > 0) serveSend(s, buf, len);
+                else if (len == 0 || errno != EAGAIN) { // All the output has been read
+                    serveUnwatchFd(fd);
+                    p->outFd = -1;
+                    serveFinishJob(s, p);
+                    serveProcessInput(s);
                 }
+                break;
 
-                searchpaths[0] = (char*) malloc(strlen(args[0]) + 1);
-                if (!searchpaths[0]) {
-                    fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
-                    exit(2);
+            case WATCH_CLIENT:
+                if ((events[i].events & (EPOLLHUP | EPOLLERR)) && s->eof) { // The client is gone completely
+                    serveCloseSession(s);
+                    break;
                 }
-
-                strcpy(searchpaths[0], args[0]);
-                searchpaths[1] = NULL;
-            }
-
-            // By default, we suppose that the executable was not found; we signify this by assigning the NULL pointer to 'command'
-            command = NULL;
-            i = 0;
-            while (searchpaths[i] != NULL) {
-                fprintf(stderr, "File [%s]: ", searchpaths[i]);
-                // Does the file at searchpaths[i] exist and do we have access to it?
-                if (access(searchpaths[i], F_OK) != 0) {
-                    if (errno == EACCES) fprintf(stderr, "access denied.\n");
-                    else if (errno == ELOOP) fprintf(stderr, "too many symbolic links.\n");
-                    else if (errno == ENAMETOOLONG) fprintf(stderr, "the path is too long.\n");
-                    else if (errno == ENOENT) fprintf(stderr, "not found.\n");
-                    else if (errno == ENOTDIR) fprintf(stderr, "wrong path.\n");
-                    else {  // Unexpected error
-                        fprintf(stderr, "\nFATAL ERROR (UNKNOWN): access() system call failed. Terminating...\n");
-                        exit(3);
+                if (events[i].events & EPOLLOUT) {  // Send the queued output
+                    len = write(fd, s->out, s->outLen);
+                    if (len < 0 && errno != EAGAIN) {   // The client is gone
+                        serveCloseSession(s);
+                        break;
                     }
-                    i++;
-                    continue;   // Go to the next path in 'searchpaths' (if such exists)
-                } else {    // The file at searchpaths[i] exists
-                    fprintf(stderr, "exists; ");
-                    if (access(searchpaths[i], X_OK) != 0) {    // Do we have the permission to execute the file at searchpaths[i]?
-                        if (errno == EFAULT || errno == EINVAL || errno == EIO || errno == ENOMEM || errno == ETXTBSY) {
-                            fprintf(stderr, "\nFATAL ERROR (UNKNOWN): access() system call failed. Terminating...\n");
-                            exit(3);
-                        } else {
-                            fprintf(stderr, "cannot be executed.\n");
-                            i++;
-                            continue;   // Go to the next path in 'searchpaths' (if such exists)
+                    if (len > 0) {
+                        memmove(s->out, s->out + len, s->outLen - len);
+                        s->outLen -= len;
+                    }
+                    if (s->outLen == 0) serveWatchFd(fd, serveClientEvents(s), WATCH_CLIENT, s, NULL);
+                    if (s->outLen < SERVE_OUT_LIMIT / 2) serveThrottle(s, 0);
+                    if (serveProcessInput(s)) break;
+                }
+                if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {   // Command lines from the client
+                    if (s->inLen + sizeof(buf) + 1 > s->inCap) {
+                        s->inCap = s->inLen + sizeof(buf) + 1;
+                        s->in = (char*) realloc(s->in, s->inCap);
+                        if (!s->in) {
+                            fprintf(stderr, "FATAL ERROR (MEMORY): Allocation failed. Terminating...\n");
+                            exit(2);
                         }
-                    } else {
-                        // We can execute the file at searchpaths[i], so we update 'command' accordingly
-                        fprintf(stderr, "executable.\n");
-                        command = searchpaths[i];
-                        break;
                     }
+                    len = read(fd, s->in + s->inLen, sizeof(buf));
+                    if (len > 0) s->inLen += len;
+                    else if (len == 0 || errno != EAGAIN) { // End of input: the remaining command lines are executed, then the session is closed
+                        s->eof = 1;
+                        serveWatchFd(fd, serveClientEvents(s), WATCH_CLIENT, s, NULL);
+                    }
+                    serveProcessInput(s);
                 }
-                i++;
+                break;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    char* prompt;   // command prompt; basically, the current working directory
+    char* inputstr; // the raw string that we input as the command line
+    size_t zero = 0;    // this is to be passed to readInputLine()
+    ssize_t linelength; // the return value of readInputLine() will be stored here
+    commandList list;   // the commands of the command line, as tokenized
+    shellNode* tree;    // the parsed command line
+    int parsed; // result of the parsing (PARSE_...)
+    int exitShell;  // non-zero if the command line executed 'exit'
+    processRecord* p;   // a job in the job table
+
+    if (argc > 1 && strcmp(argv[1], "--serve") == 0) {   // 'seashell --serve socket_path': the server mode
+        if (argc != 3) {
+            fprintf(stderr, "Usage: seashell --serve socket_path\n");
+            return 1;
+        }
+        return serveMain(argv[2]);
+    }
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {   // 'seashell -c command_line': the one-shot mode
+        if (argc < 3) {
+            fprintf(stderr, "Usage: seashell -c command_line\n");
+            return 2;
+        }
+        return runOneShot(argv[2]);
+    }
+
+    interactive = isatty(STDIN_FILENO);
+
+    if (interactive && setpgid (getpid(), getpid()) < 0) { // Put the shell into its own process group
+        fprintf(stderr, "\nFATAL ERROR (UNKNOWN): unable to set the PGID for the main process. Terminating...\n");
+        exit(3);
+    }
+
+    initSchedOptions(&bgPolicy);    // No background policy by default
+    initLimitOptions(&jobLimits);   // No resource limits by default
+    openJobExport();    // Publish the job table for seashell-top; the foreground jobs are then waited for with poll(), so that the ticks are not missed
+    if (exportTable != NULL && watchChildren() != 0) closeJobExport();
+
+    if (argc > 1) { // 'seashell script_file': execute the script instead of reading the commands from the standard input
+        runScript(argv[1]);
+    }
+    else {
+        printAbout();   // Print the About message
+
+        while (1) {
+            updateStatus(); // See if any processes stopped/terminated and we don't know about it
+            flushStatusBuffer();    // Print all the execution status update messages accumulated since the command prompt was displayed the last time
+
+            // Display the command prompt
+            prompt = getdir();
+            printf("%s> ", prompt);
+
+            // If needed, the pipes are drained, the deadlines are enforced etc. (see pollWithCapture()) until the command line comes
+            // (unless the next line is already in the input buffer)
+            if (mustPoll() && !inputPending()) {
+                struct pollfd pfd;
+                pfd.fd = STDIN_FILENO;
+                pfd.events = POLLIN;
+                pfd.revents = 0;
+                fflush(stdout);
+                waitWasInterrupted = 0;
+                pollWithCapture(&pfd, 1);
             }
 
-            if (command == NULL) {  // We were unable to find the executable
-                printf("[%s]: not a command\n", args[0]);
-            } else {    // We found the executable, and the path to it is stored in 'command'
-                fprintf(stderr, "Executing [%s]...\n", command);
+            // Read the command line
+            zero = 0;
+            inputstr = NULL;
+            linelength = readInputLine(&inputstr, &zero);
 
-                // Executing the command
-                newProcess(command, args, bckgr);
+            // Was the command line read successfully?
+            if (linelength < 0) {
+                free(inputstr);
+                if (linelength == -1) {
+                    break;  // The user pressed Ctrl-D
+                }
+                else {  // Something unexpected and bad happened
+                    fprintf(stderr, "FATAL ERROR (I/O): Unable to read the command. Terminating...\n");
+                    exit(1);
+                }
             }
 
-            // Freeing all the allocated resources
-            i = 0;
-            while (searchpaths[i] != NULL) {
-                free(searchpaths[i]);
-                i++;
+            // Tokenize the command line (and the following lines, as long as some constructs stay open) and parse it
+            initCommandList(&list);
+            addListBuffer(&list, inputstr);
+            parsed = addCommandLine(&list, inputstr, 1) == 0 ? parseCommandList(&list, &tree) : PARSE_ERROR;
+            while (parsed == PARSE_INCOMPLETE) {
+                printf("> ");
+                zero = 0;
+                inputstr = NULL;
+                if (readInputLine(&inputstr, &zero) < 0) {
+                    free(inputstr);
+                    printf("\nSyntax error: unexpected end of file.\n");
+                    parsed = PARSE_ERROR;
+                    break;
+                }
+                addListBuffer(&list, inputstr);
+                parsed = addCommandLine(&list, inputstr, 1) == 0 ? parseCommandList(&list, &tree) : PARSE_ERROR;
             }
-            free(searchpaths);
-        }
 
-        // Freeing all the allocated resources
-        free(inputstr);
-        free(args);
-        free(prompt);
-    }   // Next command prompt
+            // Execute the command line; if it was 'exit', exit the shell
+            exitShell = parsed == PARSE_OK && runNodes(tree) == RUN_EXIT;
+
+            // Freeing all the allocated resources
+            if (parsed == PARSE_OK) freeNodes(tree);
+            freeCommandList(&list);
+            free(prompt);
+            if (exitShell) break;
+        }   // Next command prompt
+    }
 
     updateStatus(); // Just before we exit the shell, let us take the status updates from all the processes that stopped/terminated so far,
                     // so that we avoid having zombies. Unfortunately, we may have some orphans when we exit the shell:
@@ -992,7 +6107,8 @@ int main(int argc, char** argv) {
                     // but it would take much more effort to implement. Also, we could just send SIGKILL to all the children, but,
                     // in my opinion, this solution is not good enough.
     flushStatusBuffer();    // Print all the status update messages that have accumulated so far
+    for (p = procs; p != NULL; p = p->next) closeCapture(p);  // Remove the log files of the captured output
 
-    printf("\nBye.\n");
+    if (argc < 2) printf("\nBye.\n");
     return 0;
 }